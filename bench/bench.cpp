@@ -0,0 +1,983 @@
+// bench.cpp: synthetic pack and idx generator, times every analysis engine on it
+//
+#include "stdafx.h"
+#include "base.hpp"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include "idxfile.hpp"
+#include "packfile.hpp"
+#include "streamfile.hpp"
+#include "ndjson.hpp"
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+
+/// same thresholds as git-waze
+const constexpr std::uint64_t LimitSize = base::Megabyte * 100;
+const constexpr std::uint64_t WarnSize = base::Megabyte * 50;
+
+namespace bench {
+	/// splitmix64, the same sequence on every platform and compiler
+	class Random {
+	public:
+		explicit Random(std::uint64_t seed) :state(seed) {}
+		std::uint64_t Next() {
+			auto z = (state += 0x9E3779B97F4A7C15ULL);
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+			return z ^ (z >> 31);
+		}
+		/// [0, n)
+		std::uint64_t Below(std::uint64_t n) {
+			return n == 0 ? 0 : Next() % n;
+		}
+		/// log-uniform in [lo, hi]: every power of two equally likely
+		std::uint64_t LogUniform(std::uint64_t lo, std::uint64_t hi) {
+			auto a = base::BitWidth(lo);
+			auto b = base::BitWidth(hi - 1);
+			auto bits = a + static_cast<unsigned>(Below(b - a + 1));
+			std::uint64_t floor = bits <= 1 ? 0 : 1ULL << (bits - 1);
+			auto v = floor + Below(floor == 0 ? 2 : floor);
+			return (std::min)((std::max)(v, lo), hi);
+		}
+	private:
+		std::uint64_t state;
+	};
+
+	enum class Sizes {
+		Small, /// 16 B - 4 KB, a source tree
+		Mixed, /// small, one blob or delta in a thousand 16 MB - 256 MB
+		Large /// 1 KB - 256 MB
+	};
+
+	struct Config {
+		std::uint64_t objects{ 100000 };
+		Sizes sizes{ Sizes::Mixed };
+		std::uint32_t deltas{ 30 }; /// percent of objects stored as deltas
+		std::uint32_t refdeltas{ 0 }; /// percent of those by base oid instead of offset
+		std::uint32_t depth{ 50 }; /// longest delta chain
+		bool largeoffsets{ false }; /// a 2 GB stored blob first, every later offset needs 64 bits
+		bool rev{ false }; /// write a .rev beside the .idx
+		std::uint64_t seed{ 1 };
+		std::uint64_t memlimit{ base::Megabyte * 256 };
+		const char *SizesName() const {
+			return sizes == Sizes::Small ? "small" : (sizes == Sizes::Mixed ? "mixed" : "large");
+		}
+		/// everything the generated files depend on, names them and keys results
+		std::string Key() const {
+			return std::string("n").append(std::to_string(objects)).append("-").append(SizesName())
+				.append("-d").append(std::to_string(deltas)).append("-r").append(std::to_string(refdeltas))
+				.append("-c").append(std::to_string(depth)).append(largeoffsets ? "-large" : "")
+				.append(rev ? "-rev" : "").append("-s").append(std::to_string(seed));
+		}
+	};
+
+	inline void PutBE32(std::uint8_t *p, std::uint32_t v) {
+		p[0] = static_cast<std::uint8_t>(v >> 24);
+		p[1] = static_cast<std::uint8_t>(v >> 16);
+		p[2] = static_cast<std::uint8_t>(v >> 8);
+		p[3] = static_cast<std::uint8_t>(v);
+	}
+	inline void PutBE64(std::uint8_t *p, std::uint64_t v) {
+		PutBE32(p, static_cast<std::uint32_t>(v >> 32));
+		PutBE32(p + 4, static_cast<std::uint32_t>(v));
+	}
+
+	/// idx position i of n -> oid. The leading 8 bytes fall inside the i-th of
+	/// n equal slices of the 64-bit range, so oids come out sorted and uniform
+	/// without sorting, and any position's oid is known without a table
+	inline void OidAt(std::uint64_t seed, std::uint64_t i, std::uint64_t n, std::uint8_t *oid) {
+		auto slice = UINT64_MAX / n;
+		Random r(seed ^ (i * 0xD1B54A32D192ED03ULL));
+		PutBE64(oid, i * slice + r.Below(slice));
+		PutBE64(oid + 8, r.Next());
+		PutBE32(oid + 16, static_cast<std::uint32_t>(r.Next()));
+	}
+
+	/// an object's inflated size and its zlib stream
+	struct Payload {
+		std::uint64_t size{ 0 };
+		std::vector<std::uint8_t> z;
+	};
+
+	/// Deflate size bytes: random up to 64 KB so small objects cost their size
+	/// on disk, zeros above so a 128 MB blob costs kilobytes to write and read
+	inline Payload Compress(Random &r, std::uint64_t size, const std::vector<std::uint8_t> *head = nullptr) {
+		Payload p;
+		p.size = size;
+		z_stream zs;
+		memset(&zs, 0, sizeof(zs));
+		deflateInit(&zs, 1);
+		std::vector<std::uint8_t> in(static_cast<std::size_t>((std::min)(size, static_cast<std::uint64_t>(1 << 20))));
+		if (size <= 64 * 1024) {
+			for (auto &c : in) {
+				c = static_cast<std::uint8_t>(r.Next());
+			}
+		}
+		if (head != nullptr) {
+			memcpy(in.data(), head->data(), (std::min)(head->size(), in.size()));
+		}
+		std::uint8_t out[1 << 16];
+		auto left = size;
+		auto first = true;
+		do {
+			auto n = (std::min)(left, static_cast<std::uint64_t>(in.size()));
+			zs.next_in = in.data();
+			zs.avail_in = static_cast<uInt>(n);
+			left -= n;
+			do {
+				zs.next_out = out;
+				zs.avail_out = sizeof(out);
+				deflate(&zs, left == 0 ? Z_FINISH : Z_NO_FLUSH);
+				p.z.insert(p.z.end(), out, out + (sizeof(out) - zs.avail_out));
+			} while (zs.avail_out == 0);
+			if (first && head != nullptr) {
+				memset(in.data(), 0, (std::min)(head->size(), in.size())); /// the header goes in once
+			}
+			first = false;
+		} while (left > 0);
+		deflateEnd(&zs);
+		return p;
+	}
+
+	/// source files and trees
+	inline std::uint64_t SmallSize(Random &r) {
+		return r.LogUniform(16, 4096);
+	}
+	/// assets and archives, a good share of them past the 50 MB and 100 MB marks
+	inline std::uint64_t LargeSize(Random &r) {
+		return r.LogUniform(1024, base::Megabyte * 256);
+	}
+
+	/// delta data: base size and result size varints, then insert instructions
+	inline std::vector<std::uint8_t> DeltaData(Random &r, std::uint64_t basesize, std::uint64_t resultsize) {
+		std::vector<std::uint8_t> d;
+		for (auto v : { basesize, resultsize }) {
+			do {
+				auto c = static_cast<std::uint8_t>(v & 0x7f);
+				v >>= 7;
+				d.push_back(c | (v != 0 ? 0x80 : 0));
+			} while (v != 0);
+		}
+		auto inserts = 1 + r.Below(4);
+		for (std::uint64_t k = 0; k < inserts; k++) {
+			auto n = 1 + r.Below(127);
+			d.push_back(static_cast<std::uint8_t>(n));
+			for (std::uint64_t j = 0; j < n; j++) {
+				d.push_back(static_cast<std::uint8_t>(r.Next()));
+			}
+		}
+		return d;
+	}
+
+	struct Generated {
+		std::filesystem::path pack;
+		std::uint64_t packbytes{ 0 };
+		std::uint64_t idxbytes{ 0 };
+		std::uint64_t ns{ 0 };
+		bool reused{ false };
+	};
+
+	/// Writes pack-<key>.pack and .idx (and .rev) into dir, unless they are
+	/// already there: the same config always gives the same bytes. Pack order
+	/// is idx order times a stride coprime to the count, so offsets arrive in
+	/// a shuffled idx order like in a real pack. Needs 8 bytes per object of
+	/// memory for the offset and crc32 tables. The trailing checksums are
+	/// derived from the seed, not SHA-1 over the content
+	class Generator {
+	public:
+		explicit Generator(const Config &cfg_) :cfg(cfg_), r(cfg_.seed) {}
+		bool Run(const std::filesystem::path &dir, Generated &g, std::wstring &err) {
+			auto t0 = std::chrono::steady_clock::now();
+			auto name = std::string("pack-").append(cfg.Key());
+			g.pack = dir / (name + ".pack");
+			auto idxfile = dir / (name + ".idx");
+			auto revfile = dir / (name + ".rev");
+			std::error_code ec;
+			if (std::filesystem::exists(g.pack, ec) && std::filesystem::exists(idxfile, ec) &&
+				(!cfg.rev || std::filesystem::exists(revfile, ec))) {
+				g.packbytes = std::filesystem::file_size(g.pack, ec);
+				g.idxbytes = std::filesystem::file_size(idxfile, ec);
+				g.reused = true;
+				return true;
+			}
+			std::filesystem::create_directories(dir, ec);
+			n = cfg.objects + (cfg.largeoffsets ? 1 : 0);
+			if (n == 0 || n > UINT32_MAX) {
+				err.assign(L"object count out of range");
+				return false;
+			}
+			stride = Stride(n);
+			Pools();
+			if (!WritePack(g.pack, g.packbytes) || !WriteIndex(idxfile, g.idxbytes) || (cfg.rev && !WriteReverse(revfile))) {
+				err.assign(L"write ").append(dir.wstring()).append(L": ").append(base::SystemError());
+				return false;
+			}
+			g.ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - t0).count());
+			return true;
+		}
+	private:
+		enum {
+			Window = 64, /// how far back a delta base can be
+			PoolSize = 64,
+			RarePoolSize = 8
+		};
+		/// the blob in front with --large-offsets
+		static constexpr std::uint64_t StoredSize = (1ULL << 31) + (1ULL << 20);
+		/// an odd stride near n/phi with gcd(stride, n) == 1
+		static std::uint64_t Stride(std::uint64_t n) {
+			auto gcd = [](std::uint64_t a, std::uint64_t b) {
+				while (b != 0) {
+					auto t = a % b;
+					a = b;
+					b = t;
+				}
+				return a;
+			};
+			auto s = (n * 618) / 1000 | 1;
+			while (gcd(s, n) != 1) {
+				s += 2;
+			}
+			return s % n == 0 ? 1 : s;
+		}
+		std::uint64_t IdxPosition(std::uint64_t p) const {
+			return (p * stride) % n;
+		}
+		/// Payloads are drawn from small pools compressed up front, the pack
+		/// writer only copies bytes. With mixed sizes the large ones sit in a
+		/// pool of their own picked once in a thousand
+		void Pools() {
+			auto size = [&](bool rare) {
+				if (rare) {
+					return r.LogUniform(base::Megabyte * 16, base::Megabyte * 256);
+				}
+				return cfg.sizes == Sizes::Large ? LargeSize(r) : SmallSize(r);
+			};
+			auto fill = [&](std::vector<Payload> &blobpool, std::vector<Payload> &deltapool, int count, bool rare) {
+				for (int k = 0; k < count; k++) {
+					blobpool.push_back(Compress(r, size(rare)));
+					auto data = DeltaData(r, SmallSize(r), size(rare));
+					deltapool.push_back(Compress(r, data.size(), &data));
+				}
+			};
+			fill(blobs, deltas, PoolSize, false);
+			if (cfg.sizes == Sizes::Mixed) {
+				fill(rareblobs, raredeltas, RarePoolSize, true);
+			}
+			for (int k = 0; k < PoolSize; k++) {
+				meta.push_back(Compress(r, r.LogUniform(64, 4096)));
+			}
+		}
+		const Payload &Pick(const std::vector<Payload> &pool, const std::vector<Payload> &rare) {
+			if (!rare.empty() && r.Below(1000) == 0) {
+				return rare[r.Below(rare.size())];
+			}
+			return pool[r.Below(pool.size())];
+		}
+		bool WritePack(const std::filesystem::path &file, std::uint64_t &bytes) {
+			std::ofstream out(file, std::ios::binary | std::ios::trunc);
+			std::vector<char> buffer(1 << 20);
+			out.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+			std::uint8_t head[12] = { 'P', 'A', 'C', 'K' };
+			PutBE32(head + 4, 2);
+			PutBE32(head + 8, static_cast<std::uint32_t>(n));
+			out.write(reinterpret_cast<const char *>(head), sizeof(head));
+			std::uint64_t offset = sizeof(head);
+			offsets.assign(static_cast<std::size_t>(n), 0);
+			crcs.assign(static_cast<std::size_t>(n), 0);
+			std::uint64_t ring[Window];
+			std::uint32_t depths[Window];
+			for (std::uint64_t p = 0; p < n; p++) {
+				std::uint8_t hdr[pack::MaxHeaderSize + 24];
+				std::size_t hlen = 0;
+				const Payload *body = nullptr;
+				std::uint32_t depth = 0;
+				auto kind = r.Below(100);
+				std::uint64_t back = 1 + r.Below((std::min)(p, static_cast<std::uint64_t>(Window - 1)));
+				std::uint8_t type = pack::Blob;
+				if (cfg.largeoffsets && p == 0) {
+					hlen = EncodeHeader(hdr, type, StoredSize);
+					auto i = IdxPosition(p);
+					offsets[i] = offset;
+					out.write(reinterpret_cast<const char *>(hdr), static_cast<std::streamsize>(hlen));
+					crcs[i] = WriteStored(out, StoredSize, static_cast<std::uint32_t>(crc32(0, hdr, static_cast<uInt>(hlen))),
+						offset);
+					offset += hlen;
+					ring[0] = sizeof(head);
+					depths[0] = 0;
+					continue;
+				}
+				if (p > 0 && kind < cfg.deltas && depths[(p - back) % Window] < cfg.depth) {
+					body = &Pick(deltas, raredeltas);
+					depth = depths[(p - back) % Window] + 1;
+					type = r.Below(100) < cfg.refdeltas ? pack::RefDelta : pack::OfsDelta;
+				}
+				else {
+					auto t = r.Below(100);
+					type = t < 10 ? pack::Commit : (t < 40 ? pack::Tree : (t < 99 ? pack::Blob : pack::Tag));
+					body = type == pack::Blob ? &Pick(blobs, rareblobs) : &meta[r.Below(PoolSize)];
+				}
+				hlen = EncodeHeader(hdr, type, body->size);
+				if (type == pack::OfsDelta) {
+					hlen += EncodeOfs(hdr + hlen, offset - ring[(p - back) % Window]);
+				}
+				else if (type == pack::RefDelta) {
+					OidAt(cfg.seed, IdxPosition(p - back), n, hdr + hlen);
+					hlen += 20;
+				}
+				auto i = IdxPosition(p);
+				offsets[i] = offset;
+				auto crc = crc32(0, hdr, static_cast<uInt>(hlen));
+				crcs[i] = static_cast<std::uint32_t>(crc32(crc, body->z.data(), static_cast<uInt>(body->z.size())));
+				out.write(reinterpret_cast<const char *>(hdr), static_cast<std::streamsize>(hlen));
+				out.write(reinterpret_cast<const char *>(body->z.data()), static_cast<std::streamsize>(body->z.size()));
+				ring[p % Window] = offset;
+				depths[p % Window] = depth;
+				offset += hlen + body->z.size();
+			}
+			Checksum(checksum, 1);
+			out.write(reinterpret_cast<const char *>(checksum), sizeof(checksum));
+			bytes = offset + sizeof(checksum);
+			out.flush();
+			return out.good();
+		}
+		/// A zlib stream of size zeros in stored blocks, as large on disk as
+		/// inflated: the only way to push later offsets past 2 GB. Returns the
+		/// crc32 of the entry, adds the stream length to offset
+		static std::uint32_t WriteStored(std::ofstream &out, std::uint64_t size, std::uint32_t crc, std::uint64_t &offset) {
+			std::vector<std::uint8_t> block(5 + 0xffff, 0);
+			const std::uint8_t zhead[2] = { 0x78, 0x01 };
+			out.write(reinterpret_cast<const char *>(zhead), sizeof(zhead));
+			crc = static_cast<std::uint32_t>(crc32(crc, zhead, sizeof(zhead)));
+			auto adler = adler32(0, nullptr, 0);
+			offset += sizeof(zhead);
+			for (auto left = size; left > 0;) {
+				auto len = static_cast<std::uint32_t>((std::min)(left, static_cast<std::uint64_t>(0xffff)));
+				left -= len;
+				block[0] = left == 0 ? 1 : 0; /// BFINAL, BTYPE 00
+				block[1] = static_cast<std::uint8_t>(len);
+				block[2] = static_cast<std::uint8_t>(len >> 8);
+				block[3] = static_cast<std::uint8_t>(~len);
+				block[4] = static_cast<std::uint8_t>(~len >> 8);
+				adler = adler32(adler, block.data() + 5, len);
+				crc = static_cast<std::uint32_t>(crc32(crc, block.data(), 5 + len));
+				out.write(reinterpret_cast<const char *>(block.data()), 5 + len);
+				offset += 5 + len;
+			}
+			std::uint8_t tail[4];
+			PutBE32(tail, static_cast<std::uint32_t>(adler));
+			out.write(reinterpret_cast<const char *>(tail), sizeof(tail));
+			offset += sizeof(tail);
+			return static_cast<std::uint32_t>(crc32(crc, tail, sizeof(tail)));
+		}
+		bool WriteIndex(const std::filesystem::path &file, std::uint64_t &bytes) {
+			std::ofstream out(file, std::ios::binary | std::ios::trunc);
+			std::vector<char> buffer(1 << 20);
+			out.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+			std::uint8_t word[8];
+			PutBE32(word, 0xff744f63);
+			PutBE32(word + 4, 2);
+			out.write(reinterpret_cast<const char *>(word), 8);
+			/// leading bytes are sorted, the fanout is a running count
+			std::uint32_t fanout[256] = { 0 };
+			std::uint8_t oid[20];
+			for (std::uint64_t i = 0; i < n; i++) {
+				OidAt(cfg.seed, i, n, oid);
+				fanout[oid[0]]++;
+			}
+			std::uint32_t total = 0;
+			for (auto c : fanout) {
+				total += c;
+				PutBE32(word, total);
+				out.write(reinterpret_cast<const char *>(word), 4);
+			}
+			for (std::uint64_t i = 0; i < n; i++) {
+				OidAt(cfg.seed, i, n, oid);
+				out.write(reinterpret_cast<const char *>(oid), 20);
+			}
+			for (auto c : crcs) {
+				PutBE32(word, c);
+				out.write(reinterpret_cast<const char *>(word), 4);
+			}
+			std::vector<std::uint64_t> large;
+			for (auto off : offsets) {
+				if (off > 0x7fffffff) {
+					PutBE32(word, 0x80000000 | static_cast<std::uint32_t>(large.size()));
+					large.push_back(off);
+				}
+				else {
+					PutBE32(word, static_cast<std::uint32_t>(off));
+				}
+				out.write(reinterpret_cast<const char *>(word), 4);
+			}
+			for (auto off : large) {
+				PutBE64(word, off);
+				out.write(reinterpret_cast<const char *>(word), 8);
+			}
+			std::uint8_t idxsum[20];
+			Checksum(idxsum, 2);
+			out.write(reinterpret_cast<const char *>(checksum), sizeof(checksum));
+			out.write(reinterpret_cast<const char *>(idxsum), sizeof(idxsum));
+			bytes = 8 + 256 * 4 + n * 28 + large.size() * 8 + 40;
+			out.flush();
+			return out.good();
+		}
+		/// pack order -> idx position
+		bool WriteReverse(const std::filesystem::path &file) {
+			std::ofstream out(file, std::ios::binary | std::ios::trunc);
+			std::vector<char> buffer(1 << 20);
+			out.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+			std::uint8_t word[12];
+			PutBE32(word, 0x52494458);
+			PutBE32(word + 4, 1);
+			PutBE32(word + 8, 1);
+			out.write(reinterpret_cast<const char *>(word), 12);
+			/// offsets rise with pack order, so sorting by offset is walking p
+			for (std::uint64_t p = 0; p < n; p++) {
+				PutBE32(word, static_cast<std::uint32_t>(IdxPosition(p)));
+				out.write(reinterpret_cast<const char *>(word), 4);
+			}
+			std::uint8_t revsum[20];
+			Checksum(revsum, 3);
+			out.write(reinterpret_cast<const char *>(checksum), sizeof(checksum));
+			out.write(reinterpret_cast<const char *>(revsum), sizeof(revsum));
+			out.flush();
+			return out.good();
+		}
+		static std::size_t EncodeHeader(std::uint8_t *p, std::uint8_t type, std::uint64_t size) {
+			std::size_t k = 0;
+			auto c = static_cast<std::uint8_t>((type << 4) | (size & 15));
+			size >>= 4;
+			while (size != 0) {
+				p[k++] = c | 0x80;
+				c = static_cast<std::uint8_t>(size & 0x7f);
+				size >>= 7;
+			}
+			p[k++] = c;
+			return k;
+		}
+		/// big endian varint where every continuation adds one, as git writes it
+		static std::size_t EncodeOfs(std::uint8_t *p, std::uint64_t distance) {
+			std::uint8_t buf[10];
+			std::size_t pos = sizeof(buf) - 1;
+			buf[pos] = distance & 127;
+			while (distance >>= 7) {
+				buf[--pos] = static_cast<std::uint8_t>(128 | (--distance & 127));
+			}
+			memcpy(p, buf + pos, sizeof(buf) - pos);
+			return sizeof(buf) - pos;
+		}
+		void Checksum(std::uint8_t *sum, std::uint64_t which) const {
+			Random c(cfg.seed * 31 + which);
+			PutBE64(sum, c.Next());
+			PutBE64(sum + 8, c.Next());
+			PutBE32(sum + 16, static_cast<std::uint32_t>(c.Next()));
+		}
+		const Config &cfg;
+		Random r;
+		std::uint64_t n{ 0 };
+		std::uint64_t stride{ 1 };
+		std::vector<Payload> blobs;
+		std::vector<Payload> deltas;
+		std::vector<Payload> rareblobs;
+		std::vector<Payload> raredeltas;
+		std::vector<Payload> meta; /// commits, trees and tags
+		std::vector<std::uint64_t> offsets; /// by idx position
+		std::vector<std::uint32_t> crcs;
+		std::uint8_t checksum[20];
+	};
+
+	/// process counters before and after one engine run
+	struct Usage {
+		std::uint64_t readbytes{ 0 }; /// through read calls, mapped pages do not count
+		std::uint64_t storagebytes{ 0 }; /// fetched from the device, zero on a warm cache
+		std::uint64_t syscalls{ 0 }; /// read and write calls
+		std::uint64_t minorfaults{ 0 };
+		std::uint64_t majorfaults{ 0 };
+		std::uint64_t peakrss{ 0 };
+	};
+
+	inline Usage Sample() {
+		Usage u;
+#ifdef _WIN32
+		IO_COUNTERS io;
+		if (GetProcessIoCounters(GetCurrentProcess(), &io)) {
+			u.readbytes = io.ReadTransferCount;
+			u.syscalls = io.ReadOperationCount + io.WriteOperationCount + io.OtherOperationCount;
+		}
+		PROCESS_MEMORY_COUNTERS pmc;
+		if (K32GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+			u.peakrss = pmc.PeakWorkingSetSize;
+			u.minorfaults = pmc.PageFaultCount;
+		}
+#else
+		std::ifstream io("/proc/self/io");
+		std::string key;
+		std::uint64_t v = 0;
+		while (io >> key >> v) {
+			if (key == "rchar:") {
+				u.readbytes = v;
+			}
+			else if (key == "read_bytes:") {
+				u.storagebytes = v;
+			}
+			else if (key == "syscr:" || key == "syscw:") {
+				u.syscalls += v;
+			}
+		}
+		struct rusage ru;
+		if (getrusage(RUSAGE_SELF, &ru) == 0) {
+			u.minorfaults = static_cast<std::uint64_t>(ru.ru_minflt);
+			u.majorfaults = static_cast<std::uint64_t>(ru.ru_majflt);
+#ifdef __APPLE__
+			u.peakrss = static_cast<std::uint64_t>(ru.ru_maxrss);
+#else
+			u.peakrss = static_cast<std::uint64_t>(ru.ru_maxrss) * 1024;
+#endif
+		}
+#endif
+		return u;
+	}
+
+	/// The pack loop before mapped views and block reads: a seek and a one byte
+	/// read per header byte of every object in idx order. Kept as the baseline
+	/// the pack engine is measured against
+	inline bool Bytewise(base::FileHandle fd, const std::filesystem::path &packfile, base::Wfs &wfs, std::wstring &err) {
+		auto idxfile = packfile;
+		base::MapView view;
+		if (!view.Open(idxfile.replace_extension(L".idx").wstring())) {
+			err = base::SystemError();
+			return false;
+		}
+		idx::IndexTables tables;
+		if (!idx::ParseIndex(view, tables)) {
+			err.assign(L"invalid idx file");
+			return false;
+		}
+		for (std::uint32_t i = 0; i < tables.norsize; i++) {
+			auto off = tables.Offset(i);
+			std::uint8_t c = 0;
+			if (base::ReadAt(fd, off, &c, 1) != 1) {
+				err.assign(L"read: ").append(base::SystemError());
+				return false;
+			}
+			auto type = static_cast<std::uint8_t>((c >> 4) & 7);
+			std::uint64_t size = c & 15;
+			for (std::uint32_t shift = 4; (c & 0x80) != 0; shift += 7) {
+				if (shift > 60 || base::ReadAt(fd, ++off, &c, 1) != 1) {
+					err.assign(L"bad object header");
+					return false;
+				}
+				size |= static_cast<std::uint64_t>(c & 0x7f) << shift;
+			}
+			wfs.stats.Add(type, size, 0);
+		}
+		return true;
+	}
+
+	/// one analysis of the generated pack the way git-waze runs it on one pack
+	inline bool Analyze(std::string_view engine, const std::filesystem::path &packfile, base::Wfs &wfs,
+		std::wstring &err) {
+		base::ArenaScope scratch(wfs.memlimit);
+		auto file = packfile.wstring();
+		if (engine == "idx") {
+			idx::IdxAnalyzer ia(wfs);
+			auto ok = ia.verify(file) && ia.review(LimitSize, WarnSize, scratch.Get());
+			err = ia.LastError();
+			return ok;
+		}
+		if (engine == "pack" || engine == "pack-prefetch") {
+			wfs.prefetch = engine == "pack-prefetch";
+			pack::PackAnalyzer pa(wfs);
+			auto ok = pa.resolve(file) && pa.review(LimitSize, WarnSize, scratch.Get());
+			err = pa.LastError();
+			return ok;
+		}
+		auto fd = base::Openreadonly(file);
+		if (fd == base::InvalidFile) {
+			err = base::SystemError();
+			return false;
+		}
+		if (engine == "pack-bytewise") {
+			auto ok = Bytewise(fd, packfile, wfs, err);
+			base::CloseFile(fd);
+			return ok;
+		}
+		pack::StreamAnalyzer sa(wfs);
+		auto ok = sa.resolve(fd) && sa.review(LimitSize, WarnSize);
+		err = sa.LastError();
+		base::CloseFile(fd);
+		return ok;
+	}
+
+	/// Drop the generated files from the page cache, as after a fresh mount.
+	/// Clean pages only, which they are once written back. Not done on Windows
+	inline void Evict(const std::filesystem::path &packfile) {
+#ifndef _WIN32
+		auto stem = packfile;
+		for (auto ext : { L".pack", L".idx", L".rev" }) {
+			auto fd = base::Openreadonly(stem.replace_extension(ext).wstring());
+			if (fd == base::InvalidFile) {
+				continue;
+			}
+			fdatasync(fd);
+			posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+			base::CloseFile(fd);
+		}
+#else
+		(void)packfile;
+#endif
+	}
+
+	/// one "kernel" record: a micro engine's time over items of the generated idx
+	inline void KernelRecord(report::NdjsonWriter &w, const Config &cfg, std::string_view engine, std::string_view kernel,
+		std::uint32_t run, std::uint64_t items, std::uint64_t ns, bool ok) {
+		w.Begin("kernel").String("key", cfg.Key()).String("engine", engine).String("kernel", kernel).Number("run", run)
+			.Number("items", items).Number("wall_ns", ns)
+			.Number("items_per_sec", ns == 0 ? 0 : items * 1000000000ULL / ns).Boolean("ok", ok);
+		w.End();
+	}
+
+	/// Every hex kernel this CPU runs over the idx SHA-1 table, one object name
+	/// per call the way reports format them. Each output is checked against the
+	/// scalar kernel's, a mismatch fails the run
+	inline bool MeasureHex(report::NdjsonWriter &w, const Config &cfg, std::uint32_t run,
+		const std::filesystem::path &packfile) {
+		auto idxfile = packfile;
+		base::MapView view;
+		idx::IndexTables tables;
+		if (!view.Open(idxfile.replace_extension(L".idx").wstring()) || !idx::ParseIndex(view, tables)) {
+			console::Printeln(L"hex: cannot read %ls", idxfile.wstring());
+			return false;
+		}
+		std::uint64_t n = tables.norsize;
+		std::vector<char> want(n * 40), got(n * 40);
+		auto ok = true;
+		for (auto k : { base::hex::Kernel::Scalar, base::hex::Kernel::Sse2, base::hex::Kernel::Ssse3,
+			base::hex::Kernel::Avx2 }) {
+			if (!base::hex::Runs(k)) {
+				continue;
+			}
+			auto out = k == base::hex::Kernel::Scalar ? want.data() : got.data();
+			auto t0 = std::chrono::steady_clock::now();
+			for (std::uint64_t i = 0; i < n; i++) {
+				base::hex::Encode(k, tables.sha1 + i * 20, 20, out + i * 40);
+			}
+			auto ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - t0).count());
+			auto same = k == base::hex::Kernel::Scalar || want == got;
+			KernelRecord(w, cfg, "hex", base::hex::KernelName(k), run, n, ns, same);
+			ok = ok && same;
+		}
+		return w.Flush() && ok;
+	}
+
+	/// Oid lookups in the generated idx: plain halving with memcmp over the
+	/// whole table and within the fanout bucket, Lookup::Find one at a time
+	/// (interpolation and the vector compare) and the batched Find. Half the
+	/// queries are hits, a quarter differ from a packed oid in the last byte
+	/// and the rest are random. Every method must give the same answers
+	inline bool MeasureLookup(report::NdjsonWriter &w, const Config &cfg, std::uint32_t run,
+		const std::filesystem::path &packfile) {
+		auto idxfile = packfile;
+		idx::Lookup lookup;
+		if (!lookup.Open(idxfile.replace_extension(L".idx").wstring())) {
+			console::Printeln(L"lookup: %ls", lookup.LastError());
+			return false;
+		}
+		const auto &t = lookup.Tables();
+		std::uint32_t n = lookup.Count();
+		if (n == 0) {
+			return true;
+		}
+		std::size_t q = n;
+		std::vector<std::uint8_t> queries(q * 20);
+		Random r(cfg.seed + run);
+		for (std::size_t k = 0; k < q; k++) {
+			auto oid = queries.data() + k * 20;
+			memcpy(oid, t.sha1 + r.Below(n) * 20ULL, 20);
+			if (k % 4 == 2) {
+				oid[19] ^= 1;
+			}
+			else if (k % 4 == 3) {
+				for (int b = 0; b < 20; b += 8) {
+					auto v = r.Next();
+					memcpy(oid + b, &v, (std::min)(8, 20 - b));
+				}
+			}
+		}
+		auto bisect = [&t, n](std::uint32_t lo, std::uint32_t hi, const std::uint8_t *oid) {
+			while (lo < hi) {
+				auto mid = lo + (hi - lo) / 2;
+				if (memcmp(t.sha1 + mid * 20ULL, oid, 20) < 0) {
+					lo = mid + 1;
+				}
+				else {
+					hi = mid;
+				}
+			}
+			return lo < n && memcmp(t.sha1 + lo * 20ULL, oid, 20) == 0 ? lo : UINT32_MAX;
+		};
+		std::vector<std::uint32_t> want(q), got(q);
+		auto ok = true;
+		for (auto method : { "binary", "fanout-binary", "interpolation", "batched" }) {
+			std::string_view m(method);
+			auto out = m == "binary" ? want.data() : got.data();
+			auto t0 = std::chrono::steady_clock::now();
+			if (m == "batched") {
+				lookup.Find(queries.data(), q, out);
+			}
+			else {
+				for (std::size_t k = 0; k < q; k++) {
+					auto oid = queries.data() + k * 20;
+					if (m == "binary") {
+						out[k] = bisect(0, n, oid);
+					}
+					else if (m == "fanout-binary") {
+						std::uint32_t lo = oid[0] == 0 ? 0 : base::LoadBE32(t.fanout + (oid[0] - 1) * 4);
+						out[k] = bisect(lo, base::LoadBE32(t.fanout + oid[0] * 4), oid);
+					}
+					else {
+						out[k] = lookup.Find(oid);
+					}
+				}
+			}
+			auto ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - t0).count());
+			auto same = m == "binary" || want == got;
+			KernelRecord(w, cfg, "lookup", m, run, q, ns, same);
+			if (!same) {
+				console::Printeln(L"lookup: %ls disagrees with binary search", base::ToWide(m));
+			}
+			ok = ok && same;
+		}
+		return w.Flush() && ok;
+	}
+
+	/// time one engine and write its record. Fresh process state on POSIX: the
+	/// run happens in a child, so peak RSS and faults are its own
+	inline bool Measure(report::NdjsonWriter &w, const Config &cfg, std::string_view engine, std::uint32_t run,
+		const std::filesystem::path &packfile, bool cold) {
+		if (cold) {
+			Evict(packfile);
+		}
+		auto body = [&]() {
+			base::Wfs wfs;
+			wfs.memlimit = static_cast<std::size_t>(cfg.memlimit);
+			std::wstring err;
+			auto before = Sample();
+			auto t0 = std::chrono::steady_clock::now();
+			auto ok = Analyze(engine, packfile, wfs, err);
+			auto ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - t0).count());
+			auto after = Sample();
+			std::uint64_t objects = 0;
+			for (std::uint8_t t = 0; t < base::Histogram::Types; t++) {
+				objects += wfs.stats.Objects(t);
+			}
+			w.Begin("bench").String("key", cfg.Key()).String("engine", engine).Number("run", run).Boolean("cold", cold)
+				.Number("objects", objects).Number("wall_ns", ns)
+				.Number("objects_per_sec", ns == 0 ? 0 : objects * 1000000000ULL / ns)
+				.Number("read_bytes", after.readbytes - before.readbytes)
+				.Number("storage_bytes", after.storagebytes - before.storagebytes)
+				.Number("syscalls", after.syscalls - before.syscalls)
+				.Number("minor_faults", after.minorfaults - before.minorfaults)
+				.Number("major_faults", after.majorfaults - before.majorfaults)
+				.Number("peak_rss", after.peakrss)
+				.Number("large", wfs.counts).Number("overlimit", wfs.overlimit.size())
+				.Boolean("ok", ok);
+			if (!ok && !err.empty()) {
+				w.String("error", err);
+			}
+			w.End();
+			return w.Flush() && ok;
+		};
+#ifdef _WIN32
+		return body();
+#else
+		if (!w.Flush()) {
+			return false;
+		}
+		auto pid = fork();
+		if (pid < 0) {
+			return body();
+		}
+		if (pid == 0) {
+			_exit(body() ? 0 : 1);
+		}
+		int status = 0;
+		while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+		}
+		return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+	}
+}
+
+void usage(const wchar_t *prog) {
+	console::Printeln(L"usage: %ls [--objects N] [--sizes small|mixed|large] [--deltas PCT] [--ref-deltas PCT] [--depth N]", prog);
+	console::Printeln(L"       [--large-offsets] [--rev] [--seed N] [--memlimit MB] [--engines idx,pack,pack-prefetch,pack-bytewise,stream,hex,lookup]");
+	console::Printeln(L"       [--repeat N] [--dir DIR] [--cold] [--clean]");
+}
+
+/// accepts '--name value' and '--name=value'
+bool OptionValue(int argc, wchar_t **argv, int &i, std::wstring_view name, std::wstring_view &value) {
+	std::wstring_view arg(argv[i]);
+	if (arg == name) {
+		if (i + 1 >= argc) {
+			return false;
+		}
+		value = argv[++i];
+		return true;
+	}
+	if (arg.size() > name.size() && arg.compare(0, name.size(), name) == 0 && arg[name.size()] == L'=') {
+		value = arg.substr(name.size() + 1);
+		return true;
+	}
+	return false;
+}
+
+int wmain(int argc, wchar_t **argv)
+{
+	bench::Config cfg;
+	std::vector<std::string> engines{ "idx", "pack", "stream" };
+	std::uint32_t repeat = 3;
+	std::filesystem::path dir = std::filesystem::temp_directory_path() / L"git-waze-bench";
+	bool clean = false;
+	bool cold = false;
+	for (auto i = 1; i < argc; i++) {
+		std::wstring_view value;
+		std::wstring_view arg(argv[i]);
+		if (OptionValue(argc, argv, i, L"--objects", value)) {
+			cfg.objects = wcstoull(value.data(), nullptr, 10);
+		}
+		else if (OptionValue(argc, argv, i, L"--sizes", value)) {
+			if (value == L"small") {
+				cfg.sizes = bench::Sizes::Small;
+			}
+			else if (value == L"mixed") {
+				cfg.sizes = bench::Sizes::Mixed;
+			}
+			else if (value == L"large") {
+				cfg.sizes = bench::Sizes::Large;
+			}
+			else {
+				usage(argv[0]);
+				return 1;
+			}
+		}
+		else if (OptionValue(argc, argv, i, L"--deltas", value)) {
+			cfg.deltas = (std::min)(static_cast<std::uint32_t>(wcstoul(value.data(), nullptr, 10)), 100U);
+		}
+		else if (OptionValue(argc, argv, i, L"--ref-deltas", value)) {
+			cfg.refdeltas = (std::min)(static_cast<std::uint32_t>(wcstoul(value.data(), nullptr, 10)), 100U);
+		}
+		else if (OptionValue(argc, argv, i, L"--depth", value)) {
+			cfg.depth = (std::min)(static_cast<std::uint32_t>(wcstoul(value.data(), nullptr, 10)), pack::MaxDeltaDepth - 1);
+		}
+		else if (OptionValue(argc, argv, i, L"--seed", value)) {
+			cfg.seed = wcstoull(value.data(), nullptr, 10);
+		}
+		else if (OptionValue(argc, argv, i, L"--memlimit", value)) {
+			cfg.memlimit = wcstoull(value.data(), nullptr, 10) * base::Megabyte;
+		}
+		else if (OptionValue(argc, argv, i, L"--repeat", value)) {
+			repeat = (std::max)(static_cast<std::uint32_t>(wcstoul(value.data(), nullptr, 10)), 1U);
+		}
+		else if (OptionValue(argc, argv, i, L"--dir", value)) {
+			dir = value;
+		}
+		else if (OptionValue(argc, argv, i, L"--engines", value)) {
+			engines.clear();
+			auto list = base::ToNarrow(value);
+			std::size_t pos = 0;
+			while (pos <= list.size()) {
+				auto comma = (std::min)(list.find(',', pos), list.size());
+				auto name = list.substr(pos, comma - pos);
+				if (name != "idx" && name != "pack" && name != "pack-prefetch" && name != "pack-bytewise" &&
+					name != "stream" && name != "hex" && name != "lookup") {
+					usage(argv[0]);
+					return 1;
+				}
+				engines.push_back(name);
+				pos = comma + 1;
+			}
+		}
+		else if (arg == L"--large-offsets") {
+			cfg.largeoffsets = true;
+		}
+		else if (arg == L"--rev") {
+			cfg.rev = true;
+		}
+		else if (arg == L"--cold") {
+			cold = true;
+		}
+		else if (arg == L"--clean") {
+			clean = true;
+		}
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	/// analyzers report large objects on the console, stdout is the baseline
+	console::RedirectToStderr();
+	report::NdjsonWriter w(base::StandardOutput());
+	bench::Generated g;
+	std::wstring err;
+	if (!bench::Generator(cfg).Run(dir, g, err)) { /// its tables are gone before the runs fork
+		console::Printeln(L"Generate: %ls", err);
+		return 1;
+	}
+	w.Begin("generate").String("key", cfg.Key()).Number("objects", cfg.objects).String("sizes", cfg.SizesName())
+		.Number("deltas", cfg.deltas).Number("ref_deltas", cfg.refdeltas).Number("depth", cfg.depth)
+		.Boolean("large_offsets", cfg.largeoffsets).Boolean("rev", cfg.rev).Number("seed", cfg.seed)
+		.Number("pack_bytes", g.packbytes).Number("idx_bytes", g.idxbytes).Number("wall_ns", g.ns)
+		.Boolean("reused", g.reused);
+	w.End();
+	auto ok = true;
+	for (const auto &e : engines) {
+		for (std::uint32_t run = 0; run < repeat; run++) {
+			if (e == "hex") {
+				ok = bench::MeasureHex(w, cfg, run, g.pack) && ok;
+				continue;
+			}
+			if (e == "lookup") {
+				ok = bench::MeasureLookup(w, cfg, run, g.pack) && ok;
+				continue;
+			}
+			ok = bench::Measure(w, cfg, e, run, g.pack, cold) && ok;
+		}
+	}
+	if (clean) {
+		std::error_code ec;
+		auto stem = g.pack;
+		std::filesystem::remove(stem, ec);
+		std::filesystem::remove(stem.replace_extension(L".idx"), ec);
+		std::filesystem::remove(stem.replace_extension(L".rev"), ec);
+	}
+	return w.Flush() && ok ? 0 : 1;
+}
+
+#ifndef _WIN32
+int main(int argc, char **argv) {
+	std::vector<std::wstring> args;
+	std::vector<wchar_t *> wargv;
+	for (int i = 0; i < argc; i++) {
+		args.push_back(base::ToWide(argv[i]));
+	}
+	for (auto &a : args) {
+		wargv.push_back(&a[0]);
+	}
+	wargv.push_back(nullptr);
+	return wmain(argc, wargv.data());
+}
+#endif
@@ -1,19 +1,40 @@
 #ifndef GIT_WAZE_BASE_HPP
 #define GIT_WAZE_BASE_HPP
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <cstring>
 #include <string>
 #include <memory>
+#include <new>
 #include <vector>
 #include <string_view>
+#include <type_traits>
+#include "hexencode.hpp"
+#include "stats.hpp"
+#ifdef _WIN32
 #include <Windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #ifndef CHECKLIMIT_RETURN
 #define CHECKLIMIT_RETURN 0
 #endif
 
+#ifdef _MSC_VER
 #define bswap32(x) _byteswap_ulong(x)
 #define bswap64(x) _byteswap_uint64(x)
+#else
+#define bswap32(x) __builtin_bswap32(x)
+#define bswap64(x) __builtin_bswap64(x)
+#endif
 
 
 namespace base {
@@ -30,38 +51,525 @@ namespace base {
 		std::wstring file;
 		std::uint64_t size;
 	};
+	struct LargeObject {
+		std::uint64_t size{ 0 }; /// object size, deltas resolved. Limits apply to this one
+		std::uint64_t disk{ 0 }; /// bytes stored in the pack or loose file, 0 when unknown
+		std::uint64_t inflated{ 0 }; /// inflated entry, for deltas the delta itself
+		std::uint64_t offset{ 0 }; /// pack offset, what streams report before an oid is known
+		std::uint8_t oid[20];
+		std::uint8_t type{ 0 }; /// pack object type, 0 when unknown
+	};
+	/// Keeps the K largest objects pushed so far: a min-heap whose root is the
+	/// smallest survivor, so each push is O(log K) and memory stays O(K).
+	/// OIDs stay binary, callers format only what they finally report.
+	class TopK {
+	public:
+		explicit TopK(std::size_t k) : capacity(k) {
+			heap.reserve(k);
+		}
+		std::size_t Capacity() const {
+			return capacity;
+		}
+		std::size_t size() const {
+			return heap.size();
+		}
+		/// a size must exceed this to enter a full heap
+		std::uint64_t Threshold() const {
+			return heap.size() < capacity ? 0 : heap.front().size;
+		}
+		void Push(std::uint64_t size, const std::uint8_t *oid) {
+			if (capacity == 0 || (heap.size() == capacity && size < heap.front().size)) {
+				return;
+			}
+			LargeObject o;
+			o.size = size;
+			memcpy(o.oid, oid, sizeof(o.oid));
+			Push(o);
+		}
+		void Push(const LargeObject &o) {
+			if (capacity == 0 || (heap.size() == capacity && !Greater(o, heap.front()))) {
+				return;
+			}
+			if (heap.size() == capacity) {
+				std::pop_heap(heap.begin(), heap.end(), Greater);
+				heap.pop_back();
+			}
+			heap.push_back(o);
+			std::push_heap(heap.begin(), heap.end(), Greater);
+		}
+		void Merge(const TopK &o) {
+			for (const auto &e : o.heap) {
+				Push(e);
+			}
+		}
+		/// largest first
+		std::vector<LargeObject> Sorted() const {
+			auto v = heap;
+			std::sort(v.begin(), v.end(), Greater);
+			return v;
+		}
+	private:
+		static bool Greater(const LargeObject &a, const LargeObject &b) {
+			if (a.size != b.size) {
+				return a.size > b.size;
+			}
+			return memcmp(a.oid, b.oid, sizeof(a.oid)) < 0;
+		}
+		std::vector<LargeObject> heap;
+		std::size_t capacity;
+	};
+	/// Monotonic per-thread scratch for one pack at a time: offset arrays,
+	/// sort buffers, memo tables. Reset rewinds without freeing, and folds the
+	/// blocks a big pack spilled into into one, so a scan over thousands of
+	/// packs stops calling the allocator after the first few. Blocks never add
+	/// up to more than the limit, Allocate fails past it
+	class Arena {
+	public:
+		enum : std::size_t {
+			BlockSize = 1 << 20,
+			Retained = 64 << 20 /// more than this is given back at Reset
+		};
+		Arena() = default;
+		Arena(const Arena &) = delete;
+		Arena &operator=(const Arena &) = delete;
+		static Arena &Local() {
+			static thread_local Arena a;
+			return a;
+		}
+		void Limit(std::size_t limit_) {
+			limit = limit_;
+		}
+		/// n uninitialized values, nullptr past the limit
+		template <typename T>
+		T *Allocate(std::size_t n) {
+			static_assert(std::is_trivially_destructible<T>::value, "arena memory is never destroyed");
+			if (limit < alignof(T) || n > (limit - alignof(T)) / sizeof(T)) {
+				return nullptr;
+			}
+			return static_cast<T *>(Bump(n * sizeof(T), alignof(T)));
+		}
+		void Reset() {
+			if (blocks.size() > 1 || reserved > Retained) {
+				auto total = reserved;
+				blocks.clear();
+				reserved = 0;
+				if (total <= Retained) {
+					Grow(total);
+				}
+			}
+			current = 0;
+			used = 0;
+			inuse = 0;
+		}
+		/// most bytes handed out between two resets
+		std::size_t Peak() const {
+			return peak;
+		}
+		bool held{ false }; /// an ArenaScope on this thread owns it
+	private:
+		struct Block {
+			std::unique_ptr<std::uint8_t[]> data;
+			std::size_t size;
+		};
+		bool Grow(std::size_t size) {
+			if (size > limit || reserved > limit - size) {
+				return false;
+			}
+			std::unique_ptr<std::uint8_t[]> data(new (std::nothrow) std::uint8_t[size]);
+			if (!data) {
+				return false;
+			}
+			blocks.push_back(Block{ std::move(data), size });
+			reserved += size;
+			return true;
+		}
+		void *Bump(std::size_t n, std::size_t align) {
+			for (;;) {
+				if (current < blocks.size()) {
+					auto at = (used + align - 1) & ~(align - 1);
+					if (at <= blocks[current].size && n <= blocks[current].size - at) {
+						used = at + n;
+						inuse += n;
+						peak = (std::max)(peak, inuse);
+						return blocks[current].data.get() + at;
+					}
+					if (current + 1 < blocks.size()) {
+						current++;
+						used = 0;
+						continue;
+					}
+				}
+				/// a block of its own for a big request, else the default size
+				if (!Grow((std::max)(static_cast<std::size_t>(BlockSize), n)) && !Grow(n)) {
+					return nullptr;
+				}
+				current = blocks.size() - 1;
+				used = 0;
+			}
+		}
+		std::vector<Block> blocks;
+		std::size_t current{ 0 };
+		std::size_t used{ 0 };
+		std::size_t reserved{ 0 };
+		std::size_t inuse{ 0 };
+		std::size_t peak{ 0 };
+		std::size_t limit{ SIZE_MAX };
+	};
+
+	/// The calling thread's arena for one pack, capped at limit and rewound
+	/// when the scope ends. A nested scope gets none and falls back to the heap
+	class ArenaScope {
+	public:
+		explicit ArenaScope(std::size_t limit) :arena(Arena::Local()) {
+			if (arena.held) {
+				nested = true;
+				return;
+			}
+			arena.held = true;
+			arena.Reset();
+			arena.Limit(limit);
+		}
+		~ArenaScope() {
+			if (!nested) {
+				arena.Reset();
+				arena.held = false;
+			}
+		}
+		ArenaScope(const ArenaScope &) = delete;
+		ArenaScope &operator=(const ArenaScope &) = delete;
+		Arena *Get() const {
+			return nested ? nullptr : &arena;
+		}
+	private:
+		Arena &arena;
+		bool nested{ false };
+	};
+
+	/// n uninitialized values from an arena, or owned on the heap without one
+	template <typename T>
+	class Scratch {
+	public:
+		bool Allocate(std::size_t n, Arena *arena) {
+			heap.reset();
+			if (arena != nullptr) {
+				ptr = arena->Allocate<T>(n);
+				return ptr != nullptr;
+			}
+			heap.reset(new (std::nothrow) T[n]);
+			ptr = heap.get();
+			return ptr != nullptr;
+		}
+		T *data() const {
+			return ptr;
+		}
+		T &operator[](std::size_t i) const {
+			return ptr[i];
+		}
+	private:
+		T *ptr{ nullptr };
+		std::unique_ptr<T[]> heap;
+	};
+
+	/// Shared by every worker of one scan: stop at the first object over the
+	/// limit, or once the deadline passed. Workers poll it between objects.
+	class Budget {
+	public:
+		typedef std::chrono::steady_clock Clock;
+		Budget() = default;
+		Budget(bool failfast_, Clock::duration timeout) : failfast(failfast_) {
+			if (timeout.count() > 0) {
+				deadline = Clock::now() + timeout;
+			}
+		}
+		bool Failfast() const {
+			return failfast;
+		}
+		void Stop() {
+			stopped.store(true, std::memory_order_relaxed);
+		}
+		bool Stopped() const {
+			return stopped.load(std::memory_order_relaxed);
+		}
+		bool TimedOut() const {
+			return expired.load(std::memory_order_relaxed);
+		}
+		/// reads the clock, callers poll it every so many objects
+		bool Expired() {
+			if (Stopped()) {
+				return true;
+			}
+			if (deadline != Clock::time_point::max() && Clock::now() >= deadline) {
+				expired.store(true, std::memory_order_relaxed);
+				Stop();
+				return true;
+			}
+			return false;
+		}
+	private:
+		Clock::time_point deadline{ Clock::time_point::max() };
+		std::atomic<bool> stopped{ false };
+		std::atomic<bool> expired{ false };
+		bool failfast{ false };
+	};
+	/// bits needed to hold v, 0 for 0
+	inline unsigned BitWidth(std::uint64_t v) {
+#ifdef _MSC_VER
+		unsigned long i = 0;
+		return _BitScanReverse64(&i, v) ? static_cast<unsigned>(i) + 1 : 0;
+#else
+		return v == 0 ? 0 : 64 - static_cast<unsigned>(__builtin_clzll(v));
+#endif
+	}
+	/// Object sizes in power of two buckets per pack type, bucket b counts
+	/// sizes in [2^(b-1), 2^b) and bucket 0 empty objects. Deltas are counted
+	/// as stored, by their own size, and add their chain depth. Plain counters:
+	/// every worker fills the one in its own Wfs and they merge at the end.
+	/// Fixed layout, the scan cache stores it as is
+	struct Histogram {
+		enum {
+			Untyped = 0, /// engines that never read object headers
+			Types = 8, /// pack type bits
+			Buckets = 65,
+			DepthBuckets = 14 /// MaxDeltaDepth is 4096
+		};
+		std::uint64_t counts[Types][Buckets];
+		std::uint64_t bytes[Types]; /// inflated
+		std::uint64_t disk[Types]; /// on disk, 0 when unknown
+		std::uint64_t depths[DepthBuckets];
+		std::uint64_t totaldepth;
+		std::uint64_t maxdepth;
+		Histogram() {
+			memset(this, 0, sizeof(*this));
+		}
+		void Add(std::uint8_t type, std::uint64_t size, std::uint64_t ondisk) {
+			type &= Types - 1;
+			counts[type][BitWidth(size)]++;
+			bytes[type] += size;
+			disk[type] += ondisk;
+		}
+		void AddDepth(std::uint32_t depth) {
+			depths[(std::min)(BitWidth(depth), static_cast<unsigned>(DepthBuckets - 1))]++;
+			totaldepth += depth;
+			maxdepth = (std::max)(maxdepth, static_cast<std::uint64_t>(depth));
+		}
+		std::uint64_t Objects(std::uint8_t type) const {
+			std::uint64_t n = 0;
+			for (auto c : counts[type]) {
+				n += c;
+			}
+			return n;
+		}
+		void Merge(const Histogram &o) {
+			for (int t = 0; t < Types; t++) {
+				for (int b = 0; b < Buckets; b++) {
+					counts[t][b] += o.counts[t][b];
+				}
+				bytes[t] += o.bytes[t];
+				disk[t] += o.disk[t];
+			}
+			for (int b = 0; b < DepthBuckets; b++) {
+				depths[b] += o.depths[b];
+			}
+			totaldepth += o.totaldepth;
+			maxdepth = (std::max)(maxdepth, o.maxdepth);
+		}
+	};
+	static_assert(std::is_trivially_copyable<Histogram>::value, "histograms are cached as is");
+
 	struct Wfs {
 		enum {
 			MaxNumberOfDetails = 7
 		};
-		std::vector<FileInfo> files;
+		TopK files{ MaxNumberOfDetails };
+		std::vector<LargeObject> overlimit; /// every object over the hard limit, already printed
 		std::size_t counts{ 0 };
-		std::size_t limits{ MaxNumberOfDetails };
+		Histogram stats; /// every object reviewed, not only the large ones
 		std::size_t memlimit{ Megabyte * 256 };
+		Budget *budget{ nullptr };
+		bool prefetch{ false }; /// read pack headers ahead through io_uring
+		/// an empty result with the same settings, for workers and per pack results
+		Wfs Fork() const {
+			Wfs w;
+			w.memlimit = memlimit;
+			w.budget = budget;
+			w.prefetch = prefetch;
+			return w;
+		}
+		/// an object went over the hard limit, true when the scan ends here
+		bool StopOnLimit() {
+			if (CHECKLIMIT_RETURN) {
+				return true;
+			}
+			if (budget != nullptr && budget->Failfast()) {
+				budget->Stop();
+				return true;
+			}
+			return false;
+		}
+		/// polled with a running object count, true once the scan should end
+		bool Interrupted(std::uint64_t n) {
+			return budget != nullptr && (budget->Stopped() || ((n & 1023) == 0 && budget->Expired()));
+		}
+		/// fold a worker's private result into this one
+		void Merge(const Wfs &o) {
+			counts += o.counts;
+			stats.Merge(o.stats);
+			files.Merge(o.files);
+			overlimit.insert(overlimit.end(), o.overlimit.begin(), o.overlimit.end());
+		}
+		void Reject(std::uint64_t size, const std::uint8_t *oid) {
+			LargeObject o;
+			o.size = size;
+			memcpy(o.oid, oid, sizeof(o.oid));
+			overlimit.push_back(o);
+		}
+	};
+
+	/// git index and pack files store integers in network order, all our targets are LE
+	inline std::uint32_t LoadBE32(const void *p) {
+		std::uint32_t v;
+		memcpy(&v, p, sizeof(v));
+		return bswap32(v);
+	}
+	inline std::uint64_t LoadBE64(const void *p) {
+		std::uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		return bswap64(v);
+	}
+
+	/// wchar_t is UTF-16 on Windows and UTF-32 on POSIX, we only need UTF-8 at the boundary
+	inline std::string ToNarrow(std::wstring_view ws) {
+		std::string str;
+#ifdef _WIN32
+		auto N = WideCharToMultiByte(CP_UTF8, 0, ws.data(), (int)ws.size(), nullptr, 0, nullptr,
+			nullptr);
+		str.resize(N);
+		WideCharToMultiByte(CP_UTF8, 0, ws.data(), (int)ws.size(), &str[0], N, nullptr, nullptr);
+#else
+		str.reserve(ws.size());
+		for (auto wc : ws) {
+			auto c = static_cast<std::uint32_t>(wc);
+			if (c < 0x80) {
+				str.push_back(static_cast<char>(c));
+			}
+			else if (c < 0x800) {
+				str.push_back(static_cast<char>(0xC0 | (c >> 6)));
+				str.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+			}
+			else if (c < 0x10000) {
+				str.push_back(static_cast<char>(0xE0 | (c >> 12)));
+				str.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+				str.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+			}
+			else {
+				str.push_back(static_cast<char>(0xF0 | (c >> 18)));
+				str.push_back(static_cast<char>(0x80 | ((c >> 12) & 0x3F)));
+				str.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+				str.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+			}
+		}
+#endif
+		return str;
+	}
+
+	inline std::wstring ToWide(std::string_view s) {
+		std::wstring ws;
+#ifdef _WIN32
+		auto N = MultiByteToWideChar(CP_UTF8, 0, s.data(), (int)s.size(), nullptr, 0);
+		ws.resize(N);
+		MultiByteToWideChar(CP_UTF8, 0, s.data(), (int)s.size(), &ws[0], N);
+#else
+		ws.reserve(s.size());
+		std::size_t i = 0;
+		while (i < s.size()) {
+			auto c = static_cast<std::uint8_t>(s[i]);
+			std::uint32_t cp = c;
+			int n = 0;
+			if (c >= 0xF0) {
+				cp = c & 0x07;
+				n = 3;
+			}
+			else if (c >= 0xE0) {
+				cp = c & 0x0F;
+				n = 2;
+			}
+			else if (c >= 0xC0) {
+				cp = c & 0x1F;
+				n = 1;
+			}
+			i++;
+			for (; n > 0 && i < s.size(); n--, i++) {
+				cp = (cp << 6) | (static_cast<std::uint8_t>(s[i]) & 0x3F);
+			}
+			ws.push_back(static_cast<wchar_t>(cp));
+		}
+#endif
+		return ws;
+	}
+
+#ifdef _WIN32
+	typedef HANDLE FileHandle;
+	inline const FileHandle InvalidFile = INVALID_HANDLE_VALUE;
+	enum SeekMethod : DWORD {
+		SeekBegin = FILE_BEGIN,
+		SeekCurrent = FILE_CURRENT,
+		SeekEnd = FILE_END
+	};
+#else
+	typedef int FileHandle;
+	inline const FileHandle InvalidFile = -1;
+	enum SeekMethod : int {
+		SeekBegin = SEEK_SET,
+		SeekCurrent = SEEK_CUR,
+		SeekEnd = SEEK_END
 	};
+#endif
 
 	template<typename IntegerT>
-	bool FileSeek(HANDLE hFile, IntegerT offset, DWORD dwMoveMethod) {
+	bool FileSeek(FileHandle hFile, IntegerT offset, SeekMethod method) {
 		static_assert(std::is_integral<IntegerT>::value, "only support integer");
+#ifdef _WIN32
 		LARGE_INTEGER li;
 		li.QuadPart = offset;
-		return SetFilePointerEx(hFile, li, nullptr, dwMoveMethod) == TRUE;
+		return SetFilePointerEx(hFile, li, nullptr, method) == TRUE;
+#else
+		return lseek(hFile, static_cast<off_t>(offset), method) != (off_t)-1;
+#endif
 	}
 
 	// support C style struct and integer(or array, pointer)
 	template<typename BaseType>
-	bool Readimpl(HANDLE hFile, BaseType *in, std::size_t num = 1) {
+	bool Readimpl(FileHandle hFile, BaseType *in, std::size_t num = 1) {
 		static_assert(
 			std::is_standard_layout<BaseType>::value || std::is_integral<BaseType>::value,
 			"only support Interger or buffer");
+#ifdef _WIN32
 		DWORD dwread = 0;
 		if (::ReadFile(hFile, in, sizeof(BaseType)*num, &dwread, nullptr)
 			&& dwread == sizeof(BaseType)*num) {
 			return true;
 		}
 		return false;
+#else
+		auto p = reinterpret_cast<char *>(in);
+		std::size_t len = sizeof(BaseType)*num;
+		while (len > 0) {
+			auto n = ::read(hFile, p, len);
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			if (n <= 0) {
+				return false;
+			}
+			p += n;
+			len -= static_cast<std::size_t>(n);
+		}
+		return true;
+#endif
 	}
-	inline HANDLE Openreadonly(std::wstring_view path) {
+	inline FileHandle Openreadonly(std::wstring_view path) {
+		stats::Add(stats::Opens);
+#ifdef _WIN32
 		auto hFile = CreateFileW(path.data(),
 			GENERIC_READ,
 			FILE_SHARE_READ,
@@ -70,21 +578,192 @@ namespace base {
 			FILE_ATTRIBUTE_NORMAL,
 			nullptr);
 		return hFile;
+#else
+		return ::open(ToNarrow(path).c_str(), O_RDONLY | O_CLOEXEC);
+#endif
 	}
 
-	inline std::int64_t Filesize(std::wstring_view path) {
-		auto hFile = Openreadonly(path);
-		if (hFile == INVALID_HANDLE_VALUE) {
-			return -1;
+	/// for appending, created when missing. Every write lands at the end
+	inline FileHandle Openappend(std::wstring_view path) {
+		stats::Add(stats::Opens);
+#ifdef _WIN32
+		return CreateFileW(path.data(),
+			FILE_APPEND_DATA,
+			FILE_SHARE_READ,
+			nullptr,
+			OPEN_ALWAYS,
+			FILE_ATTRIBUTE_NORMAL,
+			nullptr);
+#else
+		return ::open(ToNarrow(path).c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#endif
+	}
+
+	/// written data and the file size on the disk, not only in the page cache
+	inline bool SyncFile(FileHandle hFile) {
+#ifdef _WIN32
+		return FlushFileBuffers(hFile) == TRUE;
+#else
+		return ::fsync(hFile) == 0;
+#endif
+	}
+
+	inline void CloseFile(FileHandle hFile) {
+		if (hFile == InvalidFile) {
+			return;
 		}
+#ifdef _WIN32
+		CloseHandle(hFile);
+#else
+		::close(hFile);
+#endif
+	}
+
+	inline std::int64_t Filesize(FileHandle hFile) {
+#ifdef _WIN32
 		LARGE_INTEGER li;
 		if (GetFileSizeEx(hFile, &li) != TRUE) {
-			li.QuadPart = -1;
+			return -1;
 		}
-		CloseHandle(hFile);
 		return li.QuadPart;
+#else
+		struct stat st;
+		if (fstat(hFile, &st) != 0) {
+			return -1;
+		}
+		return st.st_size;
+#endif
+	}
+
+	inline std::int64_t Filesize(std::wstring_view path) {
+		auto hFile = Openreadonly(path);
+		if (hFile == InvalidFile) {
+			return -1;
+		}
+		auto size = Filesize(hFile);
+		CloseFile(hFile);
+		return size;
+	}
+
+	/// installed memory in bytes, 0 when the system does not say
+	inline std::uint64_t PhysicalMemory() {
+#ifdef _WIN32
+		MEMORYSTATUSEX ms;
+		ms.dwLength = sizeof(ms);
+		return GlobalMemoryStatusEx(&ms) ? ms.ullTotalPhys : 0;
+#else
+		auto pages = sysconf(_SC_PHYS_PAGES);
+		auto size = sysconf(_SC_PAGE_SIZE);
+		return pages > 0 && size > 0 ? static_cast<std::uint64_t>(pages) * static_cast<std::uint64_t>(size) : 0;
+#endif
+	}
+
+	/// positional read, does not move the file pointer. returns bytes read or -1
+	inline std::int64_t ReadAt(FileHandle hFile, std::uint64_t offset, void *buf, std::size_t len) {
+#ifdef _WIN32
+		OVERLAPPED ov;
+		memset(&ov, 0, sizeof(ov));
+		ov.Offset = static_cast<DWORD>(offset);
+		ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+		DWORD dwread = 0;
+		stats::Add(stats::Reads);
+		if (!::ReadFile(hFile, buf, static_cast<DWORD>(len), &dwread, &ov)) {
+			return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+		}
+		stats::Add(stats::ReadBytes, dwread);
+		return dwread;
+#else
+		auto p = reinterpret_cast<char *>(buf);
+		std::size_t total = 0;
+		while (total < len) {
+			auto n = ::pread(hFile, p + total, len - total, static_cast<off_t>(offset + total));
+			stats::Add(stats::Reads);
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			if (n < 0) {
+				return -1;
+			}
+			if (n == 0) {
+				break;
+			}
+			total += static_cast<std::size_t>(n);
+		}
+		stats::Add(stats::ReadBytes, total);
+		return static_cast<std::int64_t>(total);
+#endif
+	}
+
+	/// sequential read for pipes, returns what one read call got, 0 at the end
+	/// of the input or -1
+	inline std::int64_t ReadSome(FileHandle hFile, void *buf, std::size_t len) {
+#ifdef _WIN32
+		DWORD dwread = 0;
+		stats::Add(stats::Reads);
+		if (!::ReadFile(hFile, buf, static_cast<DWORD>(len), &dwread, nullptr)) {
+			return GetLastError() == ERROR_BROKEN_PIPE ? 0 : -1;
+		}
+		stats::Add(stats::ReadBytes, dwread);
+		return dwread;
+#else
+		for (;;) {
+			auto n = ::read(hFile, buf, len);
+			stats::Add(stats::Reads);
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			if (n > 0) {
+				stats::Add(stats::ReadBytes, static_cast<std::uint64_t>(n));
+			}
+			return n;
+		}
+#endif
+	}
+
+	inline FileHandle StandardInput() {
+#ifdef _WIN32
+		return GetStdHandle(STD_INPUT_HANDLE);
+#else
+		return STDIN_FILENO;
+#endif
+	}
+
+	inline FileHandle StandardOutput() {
+#ifdef _WIN32
+		return GetStdHandle(STD_OUTPUT_HANDLE);
+#else
+		return STDOUT_FILENO;
+#endif
+	}
+
+	/// write all of buf, false on the first failed write
+	inline bool WriteAll(FileHandle hFile, const void *buf, std::size_t len) {
+		auto p = reinterpret_cast<const char *>(buf);
+		while (len > 0) {
+#ifdef _WIN32
+			DWORD dwwrite = 0;
+			auto chunk = static_cast<DWORD>((std::min)(len, static_cast<std::size_t>(1U << 30)));
+			if (!::WriteFile(hFile, p, chunk, &dwwrite, nullptr)) {
+				return false;
+			}
+			auto n = static_cast<std::size_t>(dwwrite);
+#else
+			auto w = ::write(hFile, p, len);
+			if (w < 0 && errno == EINTR) {
+				continue;
+			}
+			if (w <= 0) {
+				return false;
+			}
+			auto n = static_cast<std::size_t>(w);
+#endif
+			p += n;
+			len -= n;
+		}
+		return true;
 	}
 
+#ifdef _WIN32
 	inline std::shared_ptr<wchar_t > SystemErrorZerocopy() {
 		LPWSTR pszbuf = nullptr;
 		auto dwret = FormatMessageW(
@@ -98,8 +777,10 @@ namespace base {
 			::LocalFree(ptr);
 		});
 	}
+#endif
 
 	inline std::wstring SystemError() {
+#ifdef _WIN32
 		LPWSTR pszbuf = nullptr;
 		auto dwret = FormatMessageW(
 			FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER,
@@ -112,45 +793,183 @@ namespace base {
 		msg.assign(pszbuf, dwret);
 		LocalFree(pszbuf);
 		return msg;
+#else
+		return ToWide(strerror(errno));
+#endif
 	}
-	inline std::wstring Sha1FromIndex(HANDLE hFile, std::uint32_t i) {
-		if (SetFilePointer(hFile,  4 + 4 + 4 + 255 * 4+i*20, nullptr, FILE_BEGIN) != 0) {
-			return L"invaild";
+
+	/// Read-only view of a whole file. pack and idx files are immutable once
+	/// written, so we map them and read tables in place instead of seek + read.
+	class MapView {
+	public:
+		MapView() = default;
+		MapView(const MapView &) = delete;
+		MapView &operator=(const MapView &) = delete;
+		~MapView() {
+			Close();
 		}
-		char sha1[20];
-		DWORD dwRead = 0;
-		if (!::ReadFile(hFile, sha1, 20, &dwRead, nullptr)) {
-			return L"invaild";
+		bool Open(std::wstring_view path) {
+			Close();
+			auto hFile = Openreadonly(path);
+			if (hFile == InvalidFile) {
+				return false;
+			}
+			auto fsize = Filesize(hFile);
+			if (fsize < 0) {
+				CloseFile(hFile);
+				return false;
+			}
+			len = static_cast<std::uint64_t>(fsize);
+			if (len == 0) {
+				/// zero-length mappings are rejected by both systems
+				CloseFile(hFile);
+				return true;
+			}
+#ifdef _WIN32
+			hMap = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			CloseFile(hFile);
+			if (hMap == nullptr) {
+				return false;
+			}
+			auto p = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+			if (p == nullptr) {
+				CloseHandle(hMap);
+				hMap = nullptr;
+				return false;
+			}
+#else
+			auto p = mmap(nullptr, static_cast<std::size_t>(len), PROT_READ, MAP_PRIVATE, hFile, 0);
+			CloseFile(hFile);
+			if (p == MAP_FAILED) {
+				return false;
+			}
+#endif
+			base = reinterpret_cast<const std::uint8_t *>(p);
+			stats::Add(stats::Maps);
+			stats::Add(stats::MappedBytes, len);
+			return true;
 		}
-		static const wchar_t hex[] = L"0123456789abcdef";
-		std::wstring ws;
-		ws.reserve(48);
-		for (int i = 0; i < 20; i++) {
-			unsigned int val = sha1[i];
-			ws.push_back(hex[val >> 4]);
-			ws.push_back(hex[val & 0xf]);
+		void Close() {
+			if (base != nullptr) {
+#ifdef _WIN32
+				UnmapViewOfFile(base);
+				CloseHandle(hMap);
+				hMap = nullptr;
+#else
+				munmap(const_cast<std::uint8_t *>(base), static_cast<std::size_t>(len));
+#endif
+			}
+			base = nullptr;
+			len = 0;
 		}
-		return ws;
-	}
-	inline const wchar_t *Sha1FromIndex(HANDLE hFile, wchar_t *buffer, std::uint32_t i) {
-		if (SetFilePointer(hFile,  4 + 4 + 4 + 255 * 4+i*20, nullptr, FILE_BEGIN) != 0) {
-			return L"invaild";
+		const std::uint8_t *data() const {
+			return base;
+		}
+		std::uint64_t size() const {
+			return len;
+		}
+		bool Contains(std::uint64_t offset, std::uint64_t n) const {
+			return offset <= len && n <= len - offset;
+		}
+		/// nullptr when [offset, offset + n) is outside the file
+		const std::uint8_t *At(std::uint64_t offset, std::uint64_t n) const {
+			if (!Contains(offset, n)) {
+				return nullptr;
+			}
+			return base + offset;
+		}
+	private:
+		const std::uint8_t *base{ nullptr };
+		std::uint64_t len{ 0 };
+#ifdef _WIN32
+		HANDLE hMap{ nullptr };
+#endif
+	};
+
+	/// Fallback for files we can't map (no address space on 32-bit, special files).
+	/// Serves short spans out of one block refilled by a positional read, so
+	/// callers walking offsets in ascending order cost one syscall per block.
+	class BlockReader {
+	public:
+		enum {
+			BlockSize = 64 * 1024
+		};
+		BlockReader() = default;
+		BlockReader(const BlockReader &) = delete;
+		BlockReader &operator=(const BlockReader &) = delete;
+		~BlockReader() {
+			CloseFile(hFile);
+		}
+		bool Open(std::wstring_view path) {
+			CloseFile(hFile);
+			if ((hFile = Openreadonly(path)) == InvalidFile) {
+				return false;
+			}
+			auto fsize = Filesize(hFile);
+			if (fsize < 0) {
+				return false;
+			}
+			len = static_cast<std::uint64_t>(fsize);
+			block.resize(BlockSize);
+			start = 0;
+			filled = 0;
+			return true;
 		}
-		char sha1[20];
-		DWORD dwRead = 0;
-		if (!ReadFile(hFile, sha1, 20, &dwRead, nullptr)) {
-			return L"invaild";
+		std::uint64_t size() const {
+			return len;
 		}
-		static const wchar_t hex[] = L"0123456789abcdef";
-		wchar_t *buf = buffer;
-		for (int i = 0; i < 20; i++) {
-			unsigned int val = sha1[i];
-			*buf++ = hex[val >> 4];
-			*buf++ = hex[val & 0xf];
+		/// up to n bytes at offset, avail receives how many are valid (short at EOF)
+		const std::uint8_t *Fetch(std::uint64_t offset, std::size_t n, std::size_t &avail) {
+			avail = 0;
+			if (offset >= len) {
+				return nullptr;
+			}
+			auto end = (std::min)(offset + n, len);
+			if (offset < start || end > start + filled) {
+				if (n > block.size()) {
+					block.resize(n);
+				}
+				auto r = ReadAt(hFile, offset, block.data(), block.size());
+				if (r <= 0) {
+					filled = 0;
+					return nullptr;
+				}
+				start = offset;
+				filled = static_cast<std::uint64_t>(r);
+			}
+			avail = static_cast<std::size_t>((std::min)(end, start + filled) - offset);
+			return block.data() + (offset - start);
+		}
+	private:
+		std::vector<std::uint8_t> block;
+		FileHandle hFile{ InvalidFile };
+		std::uint64_t len{ 0 };
+		std::uint64_t start{ 0 };
+		std::uint64_t filled{ 0 };
+	};
+
+	/// buffer needs 41 wchar_t
+	inline const wchar_t *Sha1Hex(const std::uint8_t *sha1, wchar_t *buffer) {
+		char digits[40];
+		HexEncode(sha1, 20, digits);
+		for (int i = 0; i < 40; i++) {
+			buffer[i] = static_cast<wchar_t>(digits[i]);
 		}
-		*buf = '\0';
+		buffer[40] = L'\0';
 		return buffer;
 	}
+	inline std::wstring Sha1Hex(const std::uint8_t *sha1) {
+		wchar_t buffer[48];
+		return std::wstring(Sha1Hex(sha1, buffer), 40);
+	}
+
+	/// table: the mapped idx SHA-1 table, read in place
+	inline std::wstring Sha1FromIndex(const std::uint8_t *table, std::uint32_t i) {
+		return Sha1Hex(table + static_cast<std::uint64_t>(i) * 20);
+	}
+	inline const wchar_t *Sha1FromIndex(const std::uint8_t *table, wchar_t *buffer, std::uint32_t i) {
+		return Sha1Hex(table + static_cast<std::uint64_t>(i) * 20, buffer);
+	}
 
 
 }
@@ -0,0 +1,276 @@
+#ifndef GIT_WAZE_CACHEFILE_HPP
+#define GIT_WAZE_CACHEFILE_HPP
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <vector>
+#include "base.hpp"
+
+#pragma once
+namespace cache {
+	/// git-waze.cache: Header, Entry[entries] sorted by key, one histogram per
+	/// entry, Object[objects]. Native little endian records, read straight
+	/// from the mapping. Bump Version whenever what a scan reports changes.
+	const constexpr std::uint32_t Magic = 0x435a5747; /// 'GWZC'
+	const constexpr std::uint32_t Version = 2;
+	struct Header {
+		std::uint32_t magic;
+		std::uint32_t version;
+		std::uint64_t limit;
+		std::uint64_t warn;
+		std::uint32_t topk;
+		std::uint32_t entries;
+		std::uint64_t objects;
+	};
+	struct Key {
+		std::uint8_t checksum[20]; /// pack or midx trailer
+		std::uint8_t scope[20]; /// midx trailer the result depends on, zero when none
+		std::uint8_t engine;
+		std::uint8_t reserved[7];
+		bool operator<(const Key &o) const {
+			return memcmp(this, &o, sizeof(Key)) < 0;
+		}
+		bool operator==(const Key &o) const {
+			return memcmp(this, &o, sizeof(Key)) == 0;
+		}
+	};
+	struct Entry {
+		Key key;
+		std::uint64_t counts;
+		std::uint32_t firstfile;
+		std::uint32_t nfiles;
+		std::uint32_t firstover;
+		std::uint32_t nover;
+	};
+	struct Object {
+		std::uint64_t size;
+		std::uint64_t disk;
+		std::uint64_t inflated;
+		std::uint8_t oid[20];
+		std::uint8_t type;
+		std::uint8_t reserved[3];
+	};
+	static_assert(sizeof(Header) == 40 && sizeof(Key) == 48 && sizeof(Entry) == 72 && sizeof(Object) == 48,
+		"cache records are written as is");
+
+	inline base::LargeObject Load(const Object &o) {
+		base::LargeObject lo;
+		lo.size = o.size;
+		lo.disk = o.disk;
+		lo.inflated = o.inflated;
+		lo.type = o.type;
+		memcpy(lo.oid, o.oid, sizeof(lo.oid));
+		return lo;
+	}
+	inline Object Dump(const base::LargeObject &lo) {
+		Object o;
+		memset(&o, 0, sizeof(o));
+		o.size = lo.size;
+		o.disk = lo.disk;
+		o.inflated = lo.inflated;
+		o.type = lo.type;
+		memcpy(o.oid, lo.oid, sizeof(o.oid));
+		return o;
+	}
+
+	/// last 20 bytes of a file, the checksum git puts at the end of packs,
+	/// idx and midx files
+	inline bool ReadTrailer(std::wstring_view file, std::uint64_t back, std::uint8_t *out) {
+		auto fd = base::Openreadonly(file);
+		if (fd == base::InvalidFile) {
+			return false;
+		}
+		auto size = base::Filesize(fd);
+		auto r = size >= static_cast<std::int64_t>(back) &&
+			base::ReadAt(fd, static_cast<std::uint64_t>(size) - back, out, 20) == 20;
+		base::CloseFile(fd);
+		return r;
+	}
+	/// the pack checksum is repeated in front of the idx checksum, so a key
+	/// costs a 20 byte read of the small file
+	inline bool PackChecksum(std::wstring_view packfile, std::uint8_t *out) {
+		auto idf = std::wstring(packfile.substr(0, packfile.size() - sizeof("pack") + 1)).append(L"idx");
+		return ReadTrailer(idf, 40, out);
+	}
+
+	/// Per pack results of earlier runs. Restore and Store are thread safe,
+	/// Save writes every entry restored or stored in this run, so results of
+	/// packs that went away are dropped.
+	class ScanCache {
+	public:
+		bool Open(const std::filesystem::path &file_, std::uint64_t limit_, std::uint64_t warn_) {
+			file = file_;
+			limit = limit_;
+			warn = warn_;
+			if (!view.Open(file.wstring())) {
+				return false;
+			}
+			if (!view.Contains(0, sizeof(Header))) {
+				view.Close();
+				return false;
+			}
+			Header h;
+			memcpy(&h, view.data(), sizeof(h));
+			if (h.magic != Magic || h.version != Version || h.limit != limit || h.warn != warn ||
+				h.topk != base::Wfs::MaxNumberOfDetails ||
+				!view.Contains(sizeof(Header), h.entries * (sizeof(Entry) + sizeof(base::Histogram)) +
+					h.objects * sizeof(Object))) {
+				view.Close();
+				return false;
+			}
+			entries = reinterpret_cast<const Entry *>(view.data() + sizeof(Header));
+			histograms = view.data() + sizeof(Header) + h.entries * sizeof(Entry);
+			objects = reinterpret_cast<const Object *>(histograms + h.entries * sizeof(base::Histogram));
+			nentries = h.entries;
+			nobjects = h.objects;
+			return true;
+		}
+		bool Restore(const Key &key, base::Wfs &out) {
+			auto end = entries + nentries;
+			auto e = std::lower_bound(entries, end, key, [](const Entry &a, const Key &k) {
+				return a.key < k;
+			});
+			if (e == end || !(e->key == key) || e->firstfile + static_cast<std::uint64_t>(e->nfiles) > nobjects ||
+				e->firstover + static_cast<std::uint64_t>(e->nover) > nobjects) {
+				stats::Add(stats::ScanCacheMisses);
+				return false;
+			}
+			stats::Add(stats::ScanCacheHits);
+			out.counts += static_cast<std::size_t>(e->counts);
+			base::Histogram hist;
+			memcpy(&hist, histograms + (e - entries) * sizeof(base::Histogram), sizeof(hist));
+			out.stats.Merge(hist);
+			for (std::uint32_t i = 0; i < e->nfiles; i++) {
+				out.files.Push(Load(objects[e->firstfile + i]));
+			}
+			for (std::uint32_t i = 0; i < e->nover; i++) {
+				out.overlimit.push_back(Load(objects[e->firstover + i]));
+			}
+			std::lock_guard<std::mutex> lock(mu);
+			hits++;
+			kept.push_back(Kept{ *e, hist });
+			return true;
+		}
+		void Store(const Key &key, const base::Wfs &w) {
+			std::lock_guard<std::mutex> lock(mu);
+			Entry e;
+			memset(&e, 0, sizeof(e));
+			e.key = key;
+			e.counts = w.counts;
+			auto files = w.files.Sorted();
+			e.firstfile = static_cast<std::uint32_t>(stored.size());
+			e.nfiles = static_cast<std::uint32_t>(files.size());
+			for (const auto &o : files) {
+				stored.push_back(Dump(o));
+			}
+			e.firstover = static_cast<std::uint32_t>(stored.size());
+			e.nover = static_cast<std::uint32_t>(w.overlimit.size());
+			for (const auto &o : w.overlimit) {
+				stored.push_back(Dump(o));
+			}
+			fresh.push_back(Kept{ e, w.stats });
+		}
+		/// rewrite the file when anything changed, through a rename so readers
+		/// never see a partial cache
+		bool Save() {
+			if (fresh.empty() && hits == nentries) {
+				return true;
+			}
+			std::vector<Kept> all;
+			std::vector<Object> objs;
+			for (auto k : kept) {
+				auto &e = k.entry;
+				auto base = static_cast<std::uint32_t>(objs.size());
+				objs.insert(objs.end(), objects + e.firstfile, objects + e.firstfile + e.nfiles);
+				objs.insert(objs.end(), objects + e.firstover, objects + e.firstover + e.nover);
+				e.firstover = base + e.nfiles;
+				e.firstfile = base;
+				all.push_back(k);
+			}
+			for (auto k : fresh) {
+				auto &e = k.entry;
+				auto base = static_cast<std::uint32_t>(objs.size());
+				objs.insert(objs.end(), stored.begin() + e.firstfile, stored.begin() + e.firstfile + e.nfiles);
+				objs.insert(objs.end(), stored.begin() + e.firstover, stored.begin() + e.firstover + e.nover);
+				e.firstover = base + e.nfiles;
+				e.firstfile = base;
+				all.push_back(k);
+			}
+			std::sort(all.begin(), all.end(), [](const Kept &a, const Kept &b) {
+				return a.entry.key < b.entry.key;
+			});
+			all.erase(std::unique(all.begin(), all.end(), [](const Kept &a, const Kept &b) {
+				return a.entry.key == b.entry.key;
+			}), all.end());
+			Header h;
+			memset(&h, 0, sizeof(h));
+			h.magic = Magic;
+			h.version = Version;
+			h.limit = limit;
+			h.warn = warn;
+			h.topk = base::Wfs::MaxNumberOfDetails;
+			h.entries = static_cast<std::uint32_t>(all.size());
+			h.objects = objs.size();
+			/// Windows refuses to replace a mapped file
+			view.Close();
+			entries = nullptr;
+			histograms = nullptr;
+			objects = nullptr;
+			auto tmp = file;
+			tmp += L".tmp" + std::to_wstring(ProcessId());
+			{
+				std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+				out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+				for (const auto &k : all) {
+					out.write(reinterpret_cast<const char *>(&k.entry), sizeof(Entry));
+				}
+				for (const auto &k : all) {
+					out.write(reinterpret_cast<const char *>(&k.hist), sizeof(base::Histogram));
+				}
+				out.write(reinterpret_cast<const char *>(objs.data()), objs.size() * sizeof(Object));
+				if (!out.flush()) {
+					out.close();
+					std::error_code ec;
+					std::filesystem::remove(tmp, ec);
+					return false;
+				}
+			}
+			std::error_code ec;
+			std::filesystem::rename(tmp, file, ec);
+			if (ec) {
+				std::filesystem::remove(tmp, ec);
+				return false;
+			}
+			return true;
+		}
+	private:
+		struct Kept {
+			Entry entry;
+			base::Histogram hist;
+		};
+		static std::uint64_t ProcessId() {
+#ifdef _WIN32
+			return GetCurrentProcessId();
+#else
+			return static_cast<std::uint64_t>(getpid());
+#endif
+		}
+		std::filesystem::path file;
+		base::MapView view;
+		const Entry *entries{ nullptr };
+		const std::uint8_t *histograms{ nullptr }; /// unaligned, copied out
+		const Object *objects{ nullptr };
+		std::uint32_t nentries{ 0 };
+		std::uint64_t nobjects{ 0 };
+		std::uint64_t limit{ 0 };
+		std::uint64_t warn{ 0 };
+		std::mutex mu;
+		std::size_t hits{ 0 };
+		std::vector<Kept> kept;
+		std::vector<Kept> fresh;
+		std::vector<Object> stored;
+	};
+}
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef GIT_WAZE_CHECKSUM_HPP
+#define GIT_WAZE_CHECKSUM_HPP
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <zlib.h>
+#include "base.hpp"
+
+/// SHA-NI is picked at run time: the kernel is built for it whatever the
+/// build flags and only runs on a CPU that says it has the instructions
+#if defined(__x86_64__) || defined(_M_X64)
+#define GIT_WAZE_SHA_NI 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define GIT_WAZE_SHA_TARGET
+#else
+#include <cpuid.h>
+#define GIT_WAZE_SHA_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+#endif
+#endif
+
+namespace base {
+	namespace sha1 {
+		inline std::uint32_t Rol(std::uint32_t v, int n) {
+			return (v << n) | (v >> (32 - n));
+		}
+
+		/// FIPS 180-4, one 64-byte block at a time with a 16 word rolling schedule
+		inline void BlocksScalar(std::uint32_t state[5], const std::uint8_t *p, std::size_t blocks) {
+			for (; blocks > 0; blocks--, p += 64) {
+				std::uint32_t w[16];
+				for (int i = 0; i < 16; i++) {
+					w[i] = LoadBE32(p + i * 4);
+				}
+				auto a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+				for (int i = 0; i < 80; i++) {
+					if (i >= 16) {
+						w[i & 15] = Rol(w[(i + 13) & 15] ^ w[(i + 8) & 15] ^ w[(i + 2) & 15] ^ w[i & 15], 1);
+					}
+					std::uint32_t f, k;
+					if (i < 20) {
+						f = (b & c) | (~b & d);
+						k = 0x5a827999;
+					}
+					else if (i < 40) {
+						f = b ^ c ^ d;
+						k = 0x6ed9eba1;
+					}
+					else if (i < 60) {
+						f = (b & c) | (b & d) | (c & d);
+						k = 0x8f1bbcdc;
+					}
+					else {
+						f = b ^ c ^ d;
+						k = 0xca62c1d6;
+					}
+					auto t = Rol(a, 5) + f + e + k + w[i & 15];
+					e = d;
+					d = c;
+					c = Rol(b, 30);
+					b = a;
+					a = t;
+				}
+				state[0] += a;
+				state[1] += b;
+				state[2] += c;
+				state[3] += d;
+				state[4] += e;
+			}
+		}
+
+#ifdef GIT_WAZE_SHA_NI
+		inline bool HasShaNi() {
+			unsigned a = 0, b = 0, c = 0, d = 0;
+#ifdef _MSC_VER
+			int r[4];
+			__cpuid(r, 0);
+			if (r[0] < 7) {
+				return false;
+			}
+			__cpuid(r, 1);
+			c = static_cast<unsigned>(r[2]);
+			__cpuidex(r, 7, 0);
+			b = static_cast<unsigned>(r[1]);
+#else
+			if (__get_cpuid_max(0, nullptr) < 7 || !__get_cpuid(1, &a, &b, &c, &d)) {
+				return false;
+			}
+			auto ecx1 = c;
+			__cpuid_count(7, 0, a, b, c, d);
+			c = ecx1;
+#endif
+			/// SHA (leaf 7 ebx 29), SSE4.1 (leaf 1 ecx 19), SSSE3 (leaf 1 ecx 9)
+			return (b & (1U << 29)) != 0 && (c & (1U << 19)) != 0 && (c & (1U << 9)) != 0;
+		}
+
+		/// four rounds per sha1rnds4, the schedule for group g+1 is built while
+		/// group g runs. msg[g % 4] holds the words of group g
+		template <int G>
+		GIT_WAZE_SHA_TARGET inline void Group(__m128i &abcd, __m128i &e0, __m128i &e1, __m128i *msg) {
+			constexpr int cur = G % 4;
+			if (G == 0) {
+				e0 = _mm_add_epi32(e0, msg[0]);
+				e1 = abcd;
+				abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+			}
+			else if (G % 2 == 0) {
+				e0 = _mm_sha1nexte_epu32(e0, msg[cur]);
+				e1 = abcd;
+				abcd = _mm_sha1rnds4_epu32(abcd, e0, G / 5);
+			}
+			else {
+				e1 = _mm_sha1nexte_epu32(e1, msg[cur]);
+				e0 = abcd;
+				abcd = _mm_sha1rnds4_epu32(abcd, e1, G / 5);
+			}
+			if (G >= 3 && G <= 18) {
+				msg[(G + 1) % 4] = _mm_sha1msg2_epu32(msg[(G + 1) % 4], msg[cur]);
+			}
+			if (G >= 1 && G <= 16) {
+				msg[(G + 3) % 4] = _mm_sha1msg1_epu32(msg[(G + 3) % 4], msg[cur]);
+			}
+			if (G >= 2 && G <= 17) {
+				msg[(G + 2) % 4] = _mm_xor_si128(msg[(G + 2) % 4], msg[cur]);
+			}
+		}
+
+		template <int... G>
+		GIT_WAZE_SHA_TARGET inline void Groups(__m128i &abcd, __m128i &e0, __m128i &e1, __m128i *msg,
+			std::integer_sequence<int, G...>) {
+			(Group<G>(abcd, e0, e1, msg), ...);
+		}
+
+		GIT_WAZE_SHA_TARGET inline void BlocksShaNi(std::uint32_t state[5], const std::uint8_t *p, std::size_t blocks) {
+			const __m128i swap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+			auto abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(state)), 0x1b);
+			auto e0 = _mm_set_epi32(static_cast<int>(state[4]), 0, 0, 0);
+			for (; blocks > 0; blocks--, p += 64) {
+				auto abcdsave = abcd;
+				auto esave = e0;
+				__m128i e1;
+				__m128i msg[4];
+				for (int i = 0; i < 4; i++) {
+					msg[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i * 16)), swap);
+				}
+				Groups(abcd, e0, e1, msg, std::make_integer_sequence<int, 20>());
+				e0 = _mm_sha1nexte_epu32(e0, esave);
+				abcd = _mm_add_epi32(abcd, abcdsave);
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(state), _mm_shuffle_epi32(abcd, 0x1b));
+			state[4] = static_cast<std::uint32_t>(_mm_extract_epi32(e0, 3));
+		}
+#endif
+
+		typedef void (*BlocksFn)(std::uint32_t state[5], const std::uint8_t *p, std::size_t blocks);
+		/// the fastest kernel this CPU runs, chosen once
+		inline BlocksFn Blocks() {
+#ifdef GIT_WAZE_SHA_NI
+			static const BlocksFn fn = HasShaNi() ? BlocksShaNi : BlocksScalar;
+			return fn;
+#else
+			return BlocksScalar;
+#endif
+		}
+	}
+
+	/// Streaming SHA-1 for pack, idx and rev trailers. Whole blocks of the
+	/// input are hashed in place, only a partial block is copied
+	class Sha1 {
+	public:
+		Sha1() :blocks(sha1::Blocks()) {}
+		void Update(const std::uint8_t *p, std::size_t n) {
+			total += n;
+			if (fill > 0) {
+				auto take = (std::min)(n, sizeof(block) - fill);
+				memcpy(block + fill, p, take);
+				fill += take;
+				p += take;
+				n -= take;
+				if (fill < sizeof(block)) {
+					return;
+				}
+				blocks(state, block, 1);
+				fill = 0;
+			}
+			if (n >= 64) {
+				blocks(state, p, n / 64);
+				p += n & ~static_cast<std::size_t>(63);
+				n &= 63;
+			}
+			memcpy(block, p, n);
+			fill = n;
+		}
+		void Final(std::uint8_t out[20]) {
+			std::uint8_t pad[72] = { 0x80 };
+			auto bits = total * 8;
+			auto n = (fill < 56 ? 56 : 120) - fill;
+			for (int i = 0; i < 8; i++) {
+				pad[n + i] = static_cast<std::uint8_t>(bits >> (56 - i * 8));
+			}
+			Update(pad, n + 8);
+			for (int i = 0; i < 5; i++) {
+				out[i * 4] = static_cast<std::uint8_t>(state[i] >> 24);
+				out[i * 4 + 1] = static_cast<std::uint8_t>(state[i] >> 16);
+				out[i * 4 + 2] = static_cast<std::uint8_t>(state[i] >> 8);
+				out[i * 4 + 3] = static_cast<std::uint8_t>(state[i]);
+			}
+		}
+	private:
+		std::uint32_t state[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+		std::uint8_t block[64];
+		std::size_t fill{ 0 };
+		std::uint64_t total{ 0 };
+		sha1::BlocksFn blocks;
+	};
+
+	/// idx, rev and midx files end in the SHA-1 of everything before it
+	inline bool TrailerMatches(const MapView &view) {
+		if (view.size() < 20) {
+			return false;
+		}
+		Sha1 h;
+		h.Update(view.data(), static_cast<std::size_t>(view.size() - 20));
+		std::uint8_t sum[20];
+		h.Final(sum);
+		return memcmp(sum, view.data() + view.size() - 20, 20) == 0;
+	}
+
+	/// CRC-32 as in idx v2, the zlib polynomial. zlib's braided kernel already
+	/// runs several words at a time, this only splits lengths it takes as uInt
+	inline std::uint32_t Crc32(std::uint32_t crc, const std::uint8_t *p, std::uint64_t n) {
+		const std::uint64_t chunk = 1ULL << 30;
+		while (n > 0) {
+			auto take = static_cast<uInt>((std::min)(n, chunk));
+			crc = static_cast<std::uint32_t>(crc32(crc, p, take));
+			p += take;
+			n -= take;
+		}
+		return crc;
+	}
+}
+
+#endif
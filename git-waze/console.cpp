@@ -1,15 +1,24 @@
 #include "stdafx.h"
+#include "base.hpp"
 #include "console.hpp"
 #include <unordered_map>
 
 namespace console {
+	static bool tostderr = false;
+	void RedirectToStderr() {
+		tostderr = true;
+	}
+	FILE *Output() {
+		return tostderr ? stderr : stdout;
+	}
+#ifdef _WIN32
+	static DWORD OutputHandle() {
+		return tostderr ? STD_ERROR_HANDLE : STD_OUTPUT_HANDLE;
+	}
+#endif
+
 	std::string wchar2utf8(const wchar_t *buf, size_t len) {
-		std::string str;
-		auto N = WideCharToMultiByte(CP_UTF8, 0, buf, (int)len, nullptr, 0, nullptr,
-			nullptr);
-		str.resize(N);
-		WideCharToMultiByte(CP_UTF8, 0, buf, (int)len, &str[0], N, nullptr, nullptr);
-		return str;
+		return base::ToNarrow(std::wstring_view(buf, len));
 	}
 
 	struct TerminalsColorTable {
@@ -88,35 +97,38 @@ namespace console {
 		return true;
 	}
 
+#ifdef _WIN32
 	int WriteConsoleInternal(const wchar_t *buffer, size_t len) {
 		DWORD dwWrite = 0;
-		auto hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+		auto hConsole = GetStdHandle(OutputHandle());
 		if (WriteConsoleW(hConsole, buffer, (DWORD)len, &dwWrite, nullptr)) {
 			return static_cast<int>(dwWrite);
 		}
 		return 0;
 	}
+#endif
 
 	int WriteTerminals(int color, const wchar_t *data, size_t len) {
 		TerminalsColorTable co;
 		auto str = wchar2utf8(data, len);
 		if (!TerminalsConvertColor(color, co)) {
-			return static_cast<int>(fwrite(str.data(), 1, str.size(), stdout));
+			return static_cast<int>(fwrite(str.data(), 1, str.size(), Output()));
 		}
 		if (co.blod) {
-			fprintf(stdout, "\33[1;%dm", co.index);
+			fprintf(Output(), "\33[1;%dm", co.index);
 		}
 		else {
-			fprintf(stdout, "\33[%dm", co.index);
+			fprintf(Output(), "\33[%dm", co.index);
 		}
-		auto l = fwrite(str.data(), 1, str.size(), stdout);
-		fwrite("\33[0m", 1, sizeof("\33[0m") - 1, stdout);
+		auto l = fwrite(str.data(), 1, str.size(), Output());
+		fwrite("\33[0m", 1, sizeof("\33[0m") - 1, Output());
 		return static_cast<int>(l);
 	}
 
 	// https://msdn.microsoft.com/en-us/library/windows/desktop/mt638032(v=vs.85).aspx
 	// VT
 
+#ifdef _WIN32
 	int WriteVTConsole(int color, const wchar_t *data, size_t len) {
 		TerminalsColorTable co;
 		if (!TerminalsConvertColor(color, co)) {
@@ -138,7 +150,7 @@ namespace console {
 	/// if is a Conhost
 	int WriteConhost(int color, const wchar_t *data, size_t len) {
 		CONSOLE_SCREEN_BUFFER_INFO csbi;
-		auto hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+		auto hConsole = GetStdHandle(OutputHandle());
 		GetConsoleScreenBufferInfo(hConsole, &csbi);
 		WORD oldColor = csbi.wAttributes;
 		WORD color_ = static_cast<WORD>(color);
@@ -155,13 +167,15 @@ namespace console {
 		SetConsoleTextAttribute(hConsole, oldColor);
 		return static_cast<int>(dwWrite);
 	}
+#endif
 
 	int WriteFiles(int color, const wchar_t *data, size_t len) {
 		auto buf = wchar2utf8(data, len);
-		auto N = fwrite(buf.data(), 1, buf.size(), stdout); //// write UTF8 to output
+		auto N = fwrite(buf.data(), 1, buf.size(), Output()); //// write UTF8 to output
 		return static_cast<int>(N);
 	}
 
+#ifdef _WIN32
 	bool IsWindowsConhost(HANDLE hConsole, bool &isvt) {
 		if (GetFileType(hConsole) != FILE_TYPE_CHAR) {
 			return false;
@@ -179,7 +193,7 @@ namespace console {
 	class ConsoleInternal {
 	public:
 		ConsoleInternal() {
-			HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+			HANDLE hConsole = GetStdHandle(OutputHandle());
 			if (hConsole == INVALID_HANDLE_VALUE) {
 				impl = WriteFiles;
 				return;
@@ -209,7 +223,7 @@ namespace console {
 
 	bool EnableVTMode() {
 		// Set output mode to handle virtual terminal sequences
-		HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+		HANDLE hOut = GetStdHandle(OutputHandle());
 		if (hOut == INVALID_HANDLE_VALUE) {
 			return false;
 		}
@@ -233,13 +247,35 @@ namespace console {
 	size_t WriteFormatted(const wchar_t * data, size_t len)
 	{
 		bool isvt = false;
-		auto hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+		auto hConsole = GetStdHandle(OutputHandle());
 		if (IsWindowsConhost(hConsole, isvt)) {
 			DWORD dwWrite = 0;
 			WriteConsoleW(hConsole, data, (DWORD)len, &dwWrite, nullptr);
 			return dwWrite;
 		}
 		auto str = wchar2utf8(data, len);
-		return fwrite(str.c_str(), 1, str.size(), stdout);
+		return fwrite(str.c_str(), 1, str.size(), Output());
+	}
+#else
+	int WriteConsoleInternal(const wchar_t *buffer, size_t len) {
+		return WriteFiles(0, buffer, len);
+	}
+
+	bool EnableVTMode() {
+		return isatty(fileno(Output())) != 0;
+	}
+
+	int WriteInternal(int color, const wchar_t *buf, size_t len) {
+		static const bool isterminal = isatty(fileno(Output())) != 0;
+		if (isterminal) {
+			return WriteTerminals(color, buf, len);
+		}
+		return WriteFiles(color, buf, len);
+	}
+
+	size_t WriteFormatted(const wchar_t *data, size_t len) {
+		auto str = wchar2utf8(data, len);
+		return fwrite(str.c_str(), 1, str.size(), Output());
 	}
-}
\ No newline at end of file
+#endif
+}
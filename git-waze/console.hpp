@@ -3,16 +3,25 @@
 #pragma once
 #include <cstdio>
 #include <cstdlib>
+#include <cstdint>
 #include <wchar.h>
+#ifdef _WIN32
 #ifndef _WINDOWS_
 #include <Windows.h>
 #endif
 #include <io.h>
+#else
+/// same bit layout as wincon.h, VT output maps them to SGR codes
+#define BACKGROUND_BLUE 0x0010
+#define BACKGROUND_GREEN 0x0020
+#define BACKGROUND_RED 0x0040
+#define BACKGROUND_INTENSITY 0x0080
+#endif
 #include <string>
 #include <string_view>
 namespace console {
 	namespace fc {
-		enum Color : WORD {
+		enum Color : std::uint16_t {
 			Black = 0,
 			DarkBlue = 1,
 			DarkGreen = 2,
@@ -33,7 +42,7 @@ namespace console {
 	}
 
 	namespace bc {
-		enum Color : WORD {
+		enum Color : std::uint16_t {
 			Black = 0,
 			DarkGray = BACKGROUND_BLUE | BACKGROUND_GREEN | BACKGROUND_RED,
 			Blue = BACKGROUND_BLUE,
@@ -53,6 +62,9 @@ namespace console {
 		};
 	}
 
+	/// messages go to stderr from now on, stdout carries machine readable output
+	void RedirectToStderr();
+	FILE *Output();
 	bool EnableVTMode();
 	int WriteConsoleInternal(const wchar_t *buffer, size_t len);
 	int WriteInternal(int color, const wchar_t *buf, size_t len);
@@ -68,6 +80,19 @@ namespace console {
 	template <typename... Args>
 	int StringPrint(wchar_t *const buffer, size_t const bufferCount,
 		wchar_t const *const format, Args const &... args) noexcept {
+#ifndef _WIN32
+		if (buffer == nullptr) {
+			/// glibc swprintf can't measure the output, format into scratch until it fits
+			std::wstring scratch(256, L'\0');
+			for (;;) {
+				int const n = swprintf(&scratch[0], scratch.size(), format, Argument(args)...);
+				if (n >= 0 || scratch.size() >= (1U << 20)) {
+					return n;
+				}
+				scratch.resize(scratch.size() * 2);
+			}
+		}
+#endif
 		int const result = swprintf(buffer, bufferCount, format, Argument(args)...);
 		// ASSERT(-1 != result);
 		return result;
@@ -0,0 +1,148 @@
+#ifndef GIT_WAZE_EXECUTOR_HPP
+#define GIT_WAZE_EXECUTOR_HPP
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace base {
+	/// Fixed size work-stealing pool. Every worker owns a deque, pops its own
+	/// tasks from the back and steals from the front of the others when it runs
+	/// dry. Tasks receive the worker index so they can keep private accumulators.
+	/// Deferred tasks wait in a shared backlog that is only drawn from once
+	/// there is nothing left to pop or steal.
+	class Executor {
+	public:
+		typedef std::function<void(std::size_t worker)> Task;
+		explicit Executor(std::size_t n) {
+			if (n == 0) {
+				n = 1;
+			}
+			for (std::size_t i = 0; i < n; i++) {
+				queues.emplace_back(new Queue);
+			}
+			for (std::size_t i = 0; i < n; i++) {
+				threads.emplace_back([this, i] { Run(i); });
+			}
+		}
+		Executor(const Executor &) = delete;
+		Executor &operator=(const Executor &) = delete;
+		~Executor() {
+			Wait();
+			{
+				std::lock_guard<std::mutex> lock(mu);
+				stop = true;
+			}
+			wake.notify_all();
+			for (auto &t : threads) {
+				t.join();
+			}
+		}
+		std::size_t Workers() const {
+			return queues.size();
+		}
+		/// from a worker the task goes to its own deque, otherwise round robin
+		void Submit(Task task) {
+			auto i = (self != npos && owner == this) ? self : (next++ % queues.size());
+			{
+				std::lock_guard<std::mutex> lock(queues[i]->mu);
+				queues[i]->tasks.push_back(std::move(task));
+			}
+			{
+				std::lock_guard<std::mutex> lock(mu);
+				queued++;
+				pending++;
+			}
+			wake.notify_one();
+		}
+		/// run once every deque is empty, oldest first: new work that should not
+		/// compete with what the pool is already busy with
+		void Defer(Task task) {
+			{
+				std::lock_guard<std::mutex> lock(mu);
+				backlog.push_back(std::move(task));
+				queued++;
+				pending++;
+			}
+			wake.notify_one();
+		}
+		/// block until every submitted task, including the ones they submit, finished
+		void Wait() {
+			std::unique_lock<std::mutex> lock(mu);
+			idle.wait(lock, [this] { return pending == 0; });
+		}
+	private:
+		struct Queue {
+			std::mutex mu;
+			std::deque<Task> tasks;
+		};
+		static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+		bool Take(std::size_t i, Task &task) {
+			{
+				auto &q = *queues[i];
+				std::lock_guard<std::mutex> lock(q.mu);
+				if (!q.tasks.empty()) {
+					task = std::move(q.tasks.back());
+					q.tasks.pop_back();
+					return true;
+				}
+			}
+			for (std::size_t k = 1; k < queues.size(); k++) {
+				auto &q = *queues[(i + k) % queues.size()];
+				std::lock_guard<std::mutex> lock(q.mu);
+				if (!q.tasks.empty()) {
+					task = std::move(q.tasks.front());
+					q.tasks.pop_front();
+					return true;
+				}
+			}
+			std::lock_guard<std::mutex> lock(mu);
+			if (!backlog.empty()) {
+				task = std::move(backlog.front());
+				backlog.pop_front();
+				return true;
+			}
+			return false;
+		}
+		void Run(std::size_t i) {
+			self = i;
+			owner = this;
+			for (;;) {
+				Task task;
+				if (Take(i, task)) {
+					queued--;
+					task(i);
+					std::lock_guard<std::mutex> lock(mu);
+					if (--pending == 0) {
+						idle.notify_all();
+					}
+					continue;
+				}
+				std::unique_lock<std::mutex> lock(mu);
+				wake.wait(lock, [this] { return stop || queued > 0; });
+				if (stop && queued == 0) {
+					return;
+				}
+			}
+		}
+		std::vector<std::unique_ptr<Queue>> queues;
+		std::vector<std::thread> threads;
+		std::deque<Task> backlog; /// deferred, guarded by mu
+		std::mutex mu;
+		std::condition_variable wake;
+		std::condition_variable idle;
+		std::atomic<std::size_t> queued{ 0 };
+		std::atomic<std::size_t> next{ 0 };
+		std::size_t pending{ 0 };
+		bool stop{ false };
+		static inline thread_local std::size_t self = npos;
+		static inline thread_local Executor *owner = nullptr;
+	};
+}
+
+#endif
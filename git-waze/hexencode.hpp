@@ -0,0 +1,238 @@
+#ifndef GIT_WAZE_HEXENCODE_HPP
+#define GIT_WAZE_HEXENCODE_HPP
+#pragma once
+#include <cstddef>
+#include <cstdint>
+/// Every kernel is built whatever the build flags, HexEncode uses the widest
+/// the flags allow and Encode(kernel) the one asked for, for tests and the
+/// bench to compare on a CPU that has them
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GIT_WAZE_HEX_SSE2 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define GIT_WAZE_HEX_TARGET(t)
+#else
+#define GIT_WAZE_HEX_TARGET(t) __attribute__((target(t)))
+#endif
+#endif
+
+namespace base {
+	namespace hex {
+		static const char digits[] = "0123456789abcdef";
+
+		inline void EncodeScalar(const std::uint8_t *in, std::size_t n, char *out) {
+			for (std::size_t i = 0; i < n; i++) {
+				out[i * 2] = digits[in[i] >> 4];
+				out[i * 2 + 1] = digits[in[i] & 0xf];
+			}
+		}
+
+#ifdef GIT_WAZE_HEX_SSE2
+		/// 16 bytes -> 32 lowercase hex digits, '0' + n, plus ('a' - '0' - 10) where n > 9
+		inline void Encode16Sse2(const std::uint8_t *in, char *out) {
+			const __m128i mask = _mm_set1_epi8(0x0f);
+			const __m128i nine = _mm_set1_epi8(9);
+			const __m128i zero = _mm_set1_epi8('0');
+			const __m128i alpha = _mm_set1_epi8('a' - '0' - 10);
+			auto x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+			auto hi = _mm_and_si128(_mm_srli_epi16(x, 4), mask);
+			auto lo = _mm_and_si128(x, mask);
+			hi = _mm_add_epi8(_mm_add_epi8(hi, zero), _mm_and_si128(_mm_cmpgt_epi8(hi, nine), alpha));
+			lo = _mm_add_epi8(_mm_add_epi8(lo, zero), _mm_and_si128(_mm_cmpgt_epi8(lo, nine), alpha));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_unpacklo_epi8(hi, lo));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(out + 16), _mm_unpackhi_epi8(hi, lo));
+		}
+
+		/// 16 bytes -> 32 lowercase hex digits, the nibble is the index into the digit table
+		GIT_WAZE_HEX_TARGET("ssse3") inline void Encode16Ssse3(const std::uint8_t *in, char *out) {
+			const __m128i mask = _mm_set1_epi8(0x0f);
+			const __m128i lut = _mm_loadu_si128(reinterpret_cast<const __m128i *>(digits));
+			auto x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+			auto hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(x, 4), mask));
+			auto lo = _mm_shuffle_epi8(lut, _mm_and_si128(x, mask));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_unpacklo_epi8(hi, lo));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(out + 16), _mm_unpackhi_epi8(hi, lo));
+		}
+
+		/// 32 bytes -> 64 lowercase hex digits
+		GIT_WAZE_HEX_TARGET("avx2") inline void Encode32Avx2(const std::uint8_t *in, char *out) {
+			const __m256i mask = _mm256_set1_epi8(0x0f);
+			const __m256i lut = _mm256_broadcastsi128_si256(
+				_mm_loadu_si128(reinterpret_cast<const __m128i *>(digits)));
+			auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in));
+			auto hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(x, 4), mask));
+			auto lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(x, mask));
+			/// unpack works per 128-bit lane, fix the lane order afterwards
+			auto a = _mm256_unpacklo_epi8(hi, lo);
+			auto b = _mm256_unpackhi_epi8(hi, lo);
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(out), _mm256_permute2x128_si256(a, b, 0x20));
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 32), _mm256_permute2x128_si256(a, b, 0x31));
+		}
+
+		/// Whole buffers, 16 bytes at a time. Under 16 bytes is scalar, a
+		/// ragged tail redoes the last 16 bytes: the overlapping digits are
+		/// rewritten with the same value
+		inline void EncodeSse2(const std::uint8_t *in, std::size_t n, char *out) {
+			if (n < 16) {
+				EncodeScalar(in, n, out);
+				return;
+			}
+			std::size_t i = 0;
+			for (; i + 16 <= n; i += 16) {
+				Encode16Sse2(in + i, out + i * 2);
+			}
+			if (i < n) {
+				Encode16Sse2(in + n - 16, out + (n - 16) * 2);
+			}
+		}
+
+		GIT_WAZE_HEX_TARGET("ssse3") inline void EncodeSsse3(const std::uint8_t *in, std::size_t n, char *out) {
+			if (n < 16) {
+				EncodeScalar(in, n, out);
+				return;
+			}
+			std::size_t i = 0;
+			for (; i + 16 <= n; i += 16) {
+				Encode16Ssse3(in + i, out + i * 2);
+			}
+			if (i < n) {
+				Encode16Ssse3(in + n - 16, out + (n - 16) * 2);
+			}
+		}
+
+		/// 32 bytes at a time, then 16
+		GIT_WAZE_HEX_TARGET("avx2") inline void EncodeAvx2(const std::uint8_t *in, std::size_t n, char *out) {
+			if (n < 16) {
+				EncodeScalar(in, n, out);
+				return;
+			}
+			std::size_t i = 0;
+			for (; i + 32 <= n; i += 32) {
+				Encode32Avx2(in + i, out + i * 2);
+			}
+			for (; i + 16 <= n; i += 16) {
+				Encode16Ssse3(in + i, out + i * 2);
+			}
+			if (i < n) {
+				Encode16Ssse3(in + n - 16, out + (n - 16) * 2);
+			}
+		}
+#endif
+
+		enum class Kernel : std::uint8_t {
+			Scalar,
+			Sse2,
+			Ssse3,
+			Avx2
+		};
+
+		inline const char *KernelName(Kernel k) {
+			switch (k) {
+			case Kernel::Sse2:
+				return "sse2";
+			case Kernel::Ssse3:
+				return "ssse3";
+			case Kernel::Avx2:
+				return "avx2";
+			default:
+				return "scalar";
+			}
+		}
+
+		/// whether this build has the kernel and this CPU runs it
+		inline bool Runs(Kernel k) {
+			if (k == Kernel::Scalar) {
+				return true;
+			}
+#ifdef GIT_WAZE_HEX_SSE2
+			if (k == Kernel::Sse2) {
+				return true;
+			}
+#ifdef _MSC_VER
+			int r[4];
+			__cpuid(r, 0);
+			auto leaves = r[0];
+			__cpuid(r, 1);
+			auto ecx1 = static_cast<unsigned>(r[2]);
+			if (k == Kernel::Ssse3) {
+				return (ecx1 & (1U << 9)) != 0;
+			}
+			/// AVX2 (leaf 7 ebx 5), and the OS saves the YMM state (OSXSAVE, XCR0 bits 1-2)
+			if (leaves < 7 || (ecx1 & (1U << 27)) == 0 || (_xgetbv(0) & 6) != 6) {
+				return false;
+			}
+			__cpuidex(r, 7, 0);
+			return (static_cast<unsigned>(r[1]) & (1U << 5)) != 0;
+#else
+			if (k == Kernel::Ssse3) {
+				return __builtin_cpu_supports("ssse3");
+			}
+			return __builtin_cpu_supports("avx2");
+#endif
+#else
+			return false;
+#endif
+		}
+
+		/// n bytes -> 2n digits with the given kernel, which must be one that Runs
+		inline void Encode(Kernel k, const std::uint8_t *in, std::size_t n, char *out) {
+			switch (k) {
+#ifdef GIT_WAZE_HEX_SSE2
+			case Kernel::Sse2:
+				EncodeSse2(in, n, out);
+				return;
+			case Kernel::Ssse3:
+				EncodeSsse3(in, n, out);
+				return;
+			case Kernel::Avx2:
+				EncodeAvx2(in, n, out);
+				return;
+#endif
+			default:
+				EncodeScalar(in, n, out);
+			}
+		}
+	}
+
+	/// n bytes -> 2n lowercase hex digits in out, no terminator, no allocation
+	inline void HexEncode(const std::uint8_t *in, std::size_t n, char *out) {
+#if defined(GIT_WAZE_HEX_SSE2) && defined(__AVX2__)
+		hex::EncodeAvx2(in, n, out);
+#elif defined(GIT_WAZE_HEX_SSE2) && defined(__SSSE3__)
+		hex::EncodeSsse3(in, n, out);
+#elif defined(GIT_WAZE_HEX_SSE2)
+		hex::EncodeSse2(in, n, out);
+#else
+		hex::EncodeScalar(in, n, out);
+#endif
+	}
+
+	/// 2n hex digits of either case -> n bytes, false on any other character
+	template <typename CharT>
+	bool HexDecode(const CharT *in, std::size_t n, std::uint8_t *out) {
+		auto nibble = [](CharT c) -> int {
+			if (c >= '0' && c <= '9') {
+				return c - '0';
+			}
+			if (c >= 'a' && c <= 'f') {
+				return c - 'a' + 10;
+			}
+			if (c >= 'A' && c <= 'F') {
+				return c - 'A' + 10;
+			}
+			return -1;
+		};
+		for (std::size_t i = 0; i < n; i++) {
+			auto hi = nibble(in[i * 2]);
+			auto lo = nibble(in[i * 2 + 1]);
+			if (hi < 0 || lo < 0) {
+				return false;
+			}
+			out[i] = static_cast<std::uint8_t>((hi << 4) | lo);
+		}
+		return true;
+	}
+}
+
+#endif
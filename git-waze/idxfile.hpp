@@ -1,13 +1,19 @@
 #ifndef GIT_WAZE_IDXFILE_HPP
 #define GIT_WAZE_IDXFILE_HPP
+#include <algorithm>
+#include <numeric>
 #include "base.hpp"
 #include "console.hpp"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GIT_WAZE_OID_SSE2 1
+#include <emmintrin.h>
+#endif
 #pragma once
 
 namespace idx {
 	template <typename IntegerT> struct object_base {
 		static_assert(std::is_integral<IntegerT>::value, "only support integer");
-		bool operator<(const object_base<IntegerT> &o) { return offset > o.offset; }
+		bool operator<(const object_base<IntegerT> &o) const { return offset > o.offset; }
 		IntegerT offset{ 0 };
 		std::uint32_t index{ 0 };
 	};
@@ -17,174 +23,584 @@ namespace idx {
 		std::uint32_t magic;
 		std::uint32_t version;
 	};
-	class IdxAnalyzer {
-	public:
-		IdxAnalyzer(base::Wfs &wfs_) :wfs(wfs_) {}
-		~IdxAnalyzer() {
-			if (hIdx != INVALID_HANDLE_VALUE) {
-				CloseHandle(hIdx);
+	/// memcmp order of two oids: one 16 byte vector compare finds the first
+	/// differing byte, the last 4 bytes compare as a big endian word
+	inline int CompareOid(const std::uint8_t *a, const std::uint8_t *b) {
+#ifdef GIT_WAZE_OID_SSE2
+		auto eq = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i *>(b)));
+		auto diff = ~static_cast<unsigned>(_mm_movemask_epi8(eq)) & 0xffff;
+		if (diff != 0) {
+#ifdef _MSC_VER
+			unsigned long i = 0;
+			_BitScanForward(&i, diff);
+#else
+			auto i = __builtin_ctz(diff);
+#endif
+			return a[i] < b[i] ? -1 : 1;
+		}
+		auto x = base::LoadBE32(a + 16);
+		auto y = base::LoadBE32(b + 16);
+		return x < y ? -1 : (x > y ? 1 : 0);
+#else
+		return memcmp(a, b, 20);
+#endif
+	}
+
+	/// first position in [lo, hi) of a sorted sha1 table not below oid. Oids
+	/// are uniform, so a few interpolation probes on their leading 8 bytes land
+	/// next to the answer; a skewed table falls back to halving after 8 probes
+	inline std::uint32_t LowerBound(const std::uint8_t *table, std::uint32_t lo, std::uint32_t hi,
+		const std::uint8_t *oid) {
+		auto key = base::LoadBE64(oid);
+		for (int probes = 0; probes < 8 && hi - lo > 8; probes++) {
+			auto klo = base::LoadBE64(table + lo * 20ULL);
+			auto khi = base::LoadBE64(table + (hi - 1) * 20ULL);
+			if (key < klo) {
+				return lo;
+			}
+			if (key > khi) {
+				return hi;
+			}
+			if (klo == khi) {
+				break;
+			}
+			auto mid = lo + static_cast<std::uint32_t>(static_cast<double>(key - klo) / static_cast<double>(khi - klo) *
+				(hi - 1 - lo));
+			mid = (std::min)((std::max)(mid, lo), hi - 1);
+			auto c = CompareOid(table + mid * 20ULL, oid);
+			if (c == 0) {
+				return mid;
+			}
+			if (c < 0) {
+				lo = mid + 1;
+			}
+			else {
+				hi = mid;
 			}
 		}
-		bool verify(std::wstring_view file) {
-			if ((pkflen = base::Filesize(file)) == -1) {
-				return false;
+		while (lo < hi) {
+			auto mid = lo + (hi - lo) / 2;
+			if (CompareOid(table + mid * 20ULL, oid) < 0) {
+				lo = mid + 1;
 			}
-			auto idf = std::wstring(file.substr(0, file.size() - sizeof("pack") + 1)).append(L"idx"); /// replace subffix
-			hIdx = CreateFileW(idf.data(),
-				GENERIC_READ,
-				FILE_SHARE_READ,
-				nullptr,
-				OPEN_EXISTING,
-				FILE_ATTRIBUTE_NORMAL,
-				nullptr);
-			if (hIdx == INVALID_HANDLE_VALUE) {
-				lasterror.assign(L"open idxfile: ").append(base::SystemError());
+			else {
+				hi = mid;
+			}
+		}
+		return lo;
+	}
+
+	/// search a sorted sha1 table narrowed by its fanout, UINT32_MAX when absent
+	inline std::uint32_t FindOid(const std::uint8_t *fanout, const std::uint8_t *table, const std::uint8_t *oid) {
+		std::uint32_t lo = oid[0] == 0 ? 0 : base::LoadBE32(fanout + (oid[0] - 1) * 4);
+		std::uint32_t hi = base::LoadBE32(fanout + oid[0] * 4);
+		if (lo >= hi) {
+			return UINT32_MAX;
+		}
+		auto i = LowerBound(table, lo, hi, oid);
+		return i < hi && CompareOid(table + i * 20ULL, oid) == 0 ? i : UINT32_MAX;
+	}
+
+	/// idx v2 layout: header, 256 fanout, N sha1, N crc32, N offset, M large offset, 2 checksum
+	struct IndexTables {
+		const std::uint8_t *fanout{ nullptr };
+		const std::uint8_t *sha1{ nullptr };
+		const std::uint8_t *crc32{ nullptr };
+		const std::uint8_t *offsets{ nullptr };
+		const std::uint8_t *largeoffsets{ nullptr };
+		std::uint32_t norsize{ 0 };
+		std::uint32_t lasize{ 0 };
+		/// pack offset of object i, UINT64_MAX when the large offset index is out of range
+		std::uint64_t Offset(std::uint32_t i) const {
+			auto off = base::LoadBE32(offsets + i * 4ULL);
+			if (!(off & 0x80000000)) {
+				return off;
+			}
+			off = off & 0x7fffffff;
+			if (off >= lasize) {
+				return UINT64_MAX;
+			}
+			return base::LoadBE64(largeoffsets + off * 8ULL);
+		}
+		std::uint32_t Find(const std::uint8_t *oid) const {
+			return FindOid(fanout, sha1, oid);
+		}
+	};
+
+	inline bool ParseIndex(const base::MapView &view, IndexTables &tables) {
+		constexpr std::uint64_t headsize = 4 * 2 + 4 * 256;
+		constexpr std::uint64_t tailsize = 2 * 20;
+		if (!view.Contains(0, headsize + tailsize)) {
+			return false;
+		}
+		auto idh = view.data();
+		/// we known Windows ARM is LE
+		/// https://blogs.msdn.microsoft.com/larryosterman/2005/06/07/the-endian-of-windows/
+		/// https://msdn.microsoft.com/en-us/library/dn736986.aspx
+		/// iOS is LE
+		if (base::LoadBE32(idh) != 0xff744f63 || base::LoadBE32(idh + 4) != 2) {
+			return false;
+		}
+		tables.fanout = idh + 4 * 2;
+		tables.norsize = base::LoadBE32(tables.fanout + 4 * 255);
+		std::uint64_t nr = tables.norsize;
+		if (!view.Contains(headsize, nr * (20 + 4 + 4) + tailsize)) {
+			return false;
+		}
+		tables.sha1 = tables.fanout + 4 * 256;
+		tables.crc32 = tables.sha1 + nr * 20;
+		tables.offsets = tables.crc32 + nr * 4;
+		tables.largeoffsets = tables.offsets + nr * 4;
+		tables.lasize = static_cast<std::uint32_t>((view.size() - nr * (20 + 4 + 4) - headsize - tailsize) / 8);
+		return true;
+	}
+
+	/// pack-*.rev: 'RIDX' version hashid, then the idx position of every object in pack order
+	inline const std::uint8_t *ParseReverseIndex(const base::MapView &view, std::uint32_t norsize) {
+		constexpr std::uint64_t headsize = 4 * 3;
+		if (view.size() != headsize + norsize * 4ULL + 2 * 20) {
+			return nullptr;
+		}
+		auto p = view.data();
+		if (base::LoadBE32(p) != 0x52494458 || base::LoadBE32(p + 4) != 1 || base::LoadBE32(p + 8) != 1) {
+			return nullptr;
+		}
+		return p + headsize;
+	}
+
+	/// In-place MSD radix (American flag) sort of idx positions by key(position).
+	/// Needs no scratch array, each level is two linear passes over the range.
+	template <typename KeyFn>
+	void RadixSort(std::uint32_t *a, std::size_t n, int shift, const KeyFn &key) {
+		if (n < 64) {
+			for (std::size_t i = 1; i < n; i++) {
+				auto v = a[i];
+				auto k = key(v);
+				auto j = i;
+				for (; j > 0 && key(a[j - 1]) > k; j--) {
+					a[j] = a[j - 1];
+				}
+				a[j] = v;
+			}
+			return;
+		}
+		std::size_t count[256] = { 0 };
+		for (std::size_t i = 0; i < n; i++) {
+			count[(key(a[i]) >> shift) & 0xff]++;
+		}
+		std::size_t next[256];
+		std::size_t end[256];
+		std::size_t sum = 0;
+		for (int b = 0; b < 256; b++) {
+			next[b] = sum;
+			sum += count[b];
+			end[b] = sum;
+		}
+		for (int b = 0; b < 256; b++) {
+			while (next[b] < end[b]) {
+				auto v = a[next[b]];
+				auto d = static_cast<int>((key(v) >> shift) & 0xff);
+				while (d != b) {
+					std::swap(v, a[next[d]++]);
+					d = static_cast<int>((key(v) >> shift) & 0xff);
+				}
+				a[next[b]++] = v;
+			}
+		}
+		if (shift == 0) {
+			return;
+		}
+		std::size_t begin = 0;
+		for (int b = 0; b < 256; b++) {
+			if (count[b] > 1) {
+				RadixSort(a + begin, count[b], shift - 8, key);
+			}
+			begin += count[b];
+		}
+	}
+
+	/// Fills objs with {offset, idx position} from the 4-byte offset table.
+	/// 32-bit entries are byte swapped four at a time and stored interleaved
+	/// with their positions; 64-bit entries also take the large offset of a
+	/// flagged word, only a group of four holding one leaves the vector path.
+	/// False when a flagged word points past the large offset table
+	template <typename IntegerT>
+	bool DecodeOffsets(const IndexTables &tables, object_base<IntegerT> *objs) {
+		constexpr bool large = sizeof(IntegerT) > sizeof(std::uint32_t);
+		auto decode = [&](std::uint32_t i) {
+			auto off = base::LoadBE32(tables.offsets + i * 4ULL);
+			objs[i].index = i;
+			if (!large || !(off & 0x80000000)) {
+				objs[i].offset = off;
+				return true;
+			}
+			off = off & 0x7fffffff;
+			if (off >= tables.lasize) {
 				return false;
 			}
-			if (!GetFileSizeEx(hIdx, &idxsize)) {
-				lasterror.assign(L"get idxfile size: ").append(base::SystemError());
+			objs[i].offset = static_cast<IntegerT>(base::LoadBE64(tables.largeoffsets + off * 8ULL));
+			return true;
+		};
+		std::uint32_t i = 0;
+#ifdef GIT_WAZE_OID_SSE2
+		static_assert(sizeof(object_base<IntegerT>) == (large ? 16 : 8), "object_base layout");
+		auto step = _mm_set1_epi32(4);
+		auto index = _mm_setr_epi32(0, 1, 2, 3);
+		auto zero = _mm_setzero_si128();
+		auto out = reinterpret_cast<__m128i *>(objs);
+		for (; i + 4 <= tables.norsize; i += 4, index = _mm_add_epi32(index, step)) {
+			auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables.offsets + i * 4ULL));
+#ifdef __SSSE3__
+			v = _mm_shuffle_epi8(v, _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12));
+#else
+			v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+			v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1);
+#endif
+			if (!large) {
+				_mm_storeu_si128(out + i / 2, _mm_unpacklo_epi32(v, index));
+				_mm_storeu_si128(out + i / 2 + 1, _mm_unpackhi_epi32(v, index));
+				continue;
+			}
+			if (_mm_movemask_ps(_mm_castsi128_ps(v)) != 0) {
+				for (auto k = i; k < i + 4; k++) {
+					if (!decode(k)) {
+						return false;
+					}
+				}
+				continue;
+			}
+			auto lo = _mm_unpacklo_epi32(v, zero);
+			auto hi = _mm_unpackhi_epi32(v, zero);
+			auto ilo = _mm_unpacklo_epi32(index, zero);
+			auto ihi = _mm_unpackhi_epi32(index, zero);
+			_mm_storeu_si128(out + i, _mm_unpacklo_epi64(lo, ilo));
+			_mm_storeu_si128(out + i + 1, _mm_unpackhi_epi64(lo, ilo));
+			_mm_storeu_si128(out + i + 2, _mm_unpacklo_epi64(hi, ihi));
+			_mm_storeu_si128(out + i + 3, _mm_unpackhi_epi64(hi, ihi));
+		}
+#endif
+		for (; i < tables.norsize; i++) {
+			if (!decode(i)) {
 				return false;
 			}
-			IndexHeader idh;
-			if (!base::Readimpl(hIdx, &idh)) {
+		}
+		return true;
+	}
+
+	/// One mapped .idx answering whether an oid is in the pack and where.
+	/// A batch of queries is sorted first and merged against the table: every
+	/// search gallops from where the previous one ended instead of starting over
+	class Lookup {
+	public:
+		bool Open(std::wstring_view file) {
+			if (!view.Open(file)) {
+				lasterror.assign(L"open idxfile: ").append(base::SystemError());
 				return false;
 			}
-			/// we known Windows ARM is LE
-			/// https://blogs.msdn.microsoft.com/larryosterman/2005/06/07/the-endian-of-windows/
-			/// https://msdn.microsoft.com/en-us/library/dn736986.aspx
-			/// iOS is LE
-			if (idh.version != bswap32(2)) {
+			if (!ParseIndex(view, tables)) {
+				lasterror.assign(L"invalid idxfile: ").append(file);
 				return false;
 			}
-			if (!base::FileSeek(hIdx, (std::uint64_t)(4 * 255), FILE_BEGIN)) {
+			return true;
+		}
+		const auto &LastError()const {
+			return lasterror;
+		}
+		const IndexTables &Tables() const {
+			return tables;
+		}
+		std::uint32_t Count() const {
+			return tables.norsize;
+		}
+		/// idx position, UINT32_MAX when absent
+		std::uint32_t Find(const std::uint8_t *oid) const {
+			return tables.Find(oid);
+		}
+		/// pack offset of oid, false when absent
+		bool Offset(const std::uint8_t *oid, std::uint64_t &offset) const {
+			auto i = tables.Find(oid);
+			if (i == UINT32_MAX) {
 				return false;
 			}
-			std::uint32_t nr;
-			if (!base::Readimpl(hIdx, &nr)) {
+			offset = tables.Offset(i);
+			return offset != UINT64_MAX;
+		}
+		/// out[k] is the idx position of the k-th of n oids packed 20 bytes apart
+		void Find(const std::uint8_t *oids, std::size_t n, std::uint32_t *out) const {
+			/// radix order on the leading 8 bytes; the rare tie beyond them just
+			/// restarts its search at the fanout bucket
+			std::vector<std::uint32_t> order(n);
+			std::iota(order.begin(), order.end(), 0U);
+			RadixSort(order.data(), n, 56, [oids](std::uint32_t k) {
+				return base::LoadBE64(oids + k * 20ULL);
+			});
+			std::uint32_t cursor = 0;
+			const std::uint8_t *prev = nullptr;
+			for (auto k : order) {
+				auto oid = oids + k * 20ULL;
+				std::uint32_t lo = oid[0] == 0 ? 0 : base::LoadBE32(tables.fanout + (oid[0] - 1) * 4);
+				std::uint32_t hi = base::LoadBE32(tables.fanout + oid[0] * 4);
+				if (prev == nullptr || CompareOid(prev, oid) <= 0) {
+					lo = (std::max)(lo, cursor);
+				}
+				prev = oid;
+				/// gallop to a window holding the answer, then search inside it
+				for (std::uint64_t step = 1; lo < hi; step *= 2) {
+					auto p = lo + static_cast<std::uint32_t>((std::min)(step, static_cast<std::uint64_t>(hi - lo))) - 1;
+					if (CompareOid(tables.sha1 + p * 20ULL, oid) >= 0) {
+						hi = p + 1;
+						break;
+					}
+					lo = p + 1;
+				}
+				cursor = LowerBound(tables.sha1, lo, hi, oid);
+				out[k] = cursor < hi && CompareOid(tables.sha1 + cursor * 20ULL, oid) == 0 ? cursor : UINT32_MAX;
+			}
+		}
+	private:
+		base::MapView view;
+		IndexTables tables;
+		std::wstring lasterror;
+	};
+
+	/// the oids of a set of packs, for telling whether a loose object is also packed
+	class PackedSet {
+	public:
+		bool Add(std::wstring_view packfile) {
+			auto idf = std::wstring(packfile.substr(0, packfile.size() - sizeof("pack") + 1)).append(L"idx");
+			std::unique_ptr<Lookup> index(new Lookup);
+			if (!index->Open(idf)) {
 				return false;
 			}
-			norsize = bswap32(nr);
-			lasize = static_cast<std::uint32_t>((idxsize.QuadPart - norsize * (20 + 4 + 4) - 4 * 2 - 4 * 256 - 2 * 20) / 8);
+			indexes.push_back(std::move(index));
 			return true;
 		}
-		bool review(std::uint64_t limit, std::uint64_t warn) {
-			if (lasize > 0) {
-				return reviewlarge(limit, warn);
+		bool Contains(const std::uint8_t *oid) const {
+			for (const auto &index : indexes) {
+				if (index->Find(oid) != UINT32_MAX) {
+					return true;
+				}
 			}
-			return reviewsmall(limit, warn);
+			return false;
 		}
 	private:
-		bool reviewsmall(std::uint64_t limit, std::uint64_t warn) {
-			if (base::FileSeek(hIdx, 4 + 4 + norsize * (20 + 4) + 256 * 4, FILE_BEGIN)) {
+		std::vector<std::unique_ptr<Lookup>> indexes;
+	};
+
+	class IdxAnalyzer {
+	public:
+		IdxAnalyzer(base::Wfs &wfs_) :wfs(wfs_) {}
+		~IdxAnalyzer() = default;
+		const auto &LastError()const {
+			return lasterror;
+		}
+		bool verify(std::wstring_view file) {
+			stats::Timer timer(stats::Verify);
+			if ((pkflen = base::Filesize(file)) == -1) {
+				lasterror.assign(L"get packfile size: ").append(base::SystemError());
 				return false;
 			}
-			if (norsize * sizeof(ObjectIndex) > wfs.memlimit) {
+			auto idf = std::wstring(file.substr(0, file.size() - sizeof("pack") + 1)).append(L"idx"); /// replace subffix
+			if (!idx.Open(idf)) {
+				lasterror.assign(L"open idxfile: ").append(base::SystemError());
 				return false;
 			}
-			std::vector<ObjectIndex> objs(norsize);
-			auto objsraw = objs.data();
-			auto bufc = reinterpret_cast<char *>(objsraw);
-			auto binteger = reinterpret_cast<std::uint32_t*>(
-				bufc + (sizeof(ObjectIndex) - sizeof(std::uint32_t))*norsize);
-			if (!base::Readimpl(hIdx, binteger, norsize)) {
+			if (!ParseIndex(idx, tables)) {
+				lasterror.assign(L"invalid idxfile: ").append(idf);
 				return false;
 			}
-			for (std::uint32_t i = 0; i < norsize; i++) {
-				objsraw[i].offset = ntohl(binteger[i]);
-				objsraw[i].index = i;
+			norsize = tables.norsize;
+			lasize = tables.lasize;
+			auto ridf = std::wstring(file.substr(0, file.size() - sizeof("pack") + 1)).append(L"rev");
+			if (rev.Open(ridf)) {
+				revtable = ParseReverseIndex(rev, norsize);
+			}
+			return true;
+		}
+		const IndexTables &Tables() const {
+			return tables;
+		}
+		/// only report objects whose bit is set, every object still bounds its
+		/// neighbour. Used to count an object stored in several packs once
+		void Select(const std::vector<bool> *keep_) {
+			keep = keep_;
+		}
+		/// scratch comes from the arena when given one, else from the heap
+		bool review(std::uint64_t limit, std::uint64_t warn, base::Arena *arena = nullptr) {
+			auto footprint = lasize > 0 ? norsize * sizeof(ObjectIndexLarge) + sizeof(std::uint64_t) * lasize
+				: norsize * sizeof(ObjectIndex);
+			if (revtable != nullptr || keep != nullptr || footprint > wfs.memlimit) {
+				return reviewstream(limit, warn, arena);
+			}
+			if (lasize > 0) {
+				return reviewsorted<std::uint64_t>(limit, warn, arena);
+			}
+			return reviewsorted<std::uint32_t>(limit, warn, arena);
+		}
+		/// Offset order without object_base arrays: read it from the .rev when git
+		/// wrote one, else radix sort 4-byte idx positions one offset window at a
+		/// time so at most memlimit bytes of positions are alive.
+		bool reviewstream(std::uint64_t limit, std::uint64_t warn, base::Arena *arena = nullptr) {
+			if (norsize == 0) {
+				return true;
 			}
-			std::sort(objs.begin(), objs.end());
 			std::uint64_t pre = pkflen - 20;
-			for (const auto &i : objs) {
-				auto size = pre - i.offset;
-				pre = i.offset;
-				if (size > limit) {
-					console::Printeln(L"File: %s size %4.2f MB, more than %4.2f MB",
-						base::Sha1FromIndex(hIdx, i.offset), (float)size / base::Megabyte,
-						(float)limit / base::Megabyte);
-#if CHECKLIMIT_RETURN
+			if (revtable != nullptr) {
+				stats::Timer timer(stats::Review);
+				for (auto k = norsize; k > 0; k--) {
+					auto i = base::LoadBE32(revtable + (k - 1) * 4ULL);
+					if (i >= norsize || !account(i, tables.Offset(i), pre, limit, warn)) {
+						return false;
+					}
+				}
+				return true;
+			}
+			/// histogram of offsets in 64K windows, then group windows into chunks
+			/// holding at most 'capacity' objects
+			stats::Timer sorting(stats::Sort);
+			int bits = 1;
+			while (bits < 64 && (pre >> bits) != 0) {
+				bits++;
+			}
+			int shift = bits > 16 ? bits - 16 : 0;
+			auto nwindows = static_cast<std::size_t>(((pre - 1) >> shift) + 1);
+			base::Scratch<std::uint32_t> windows;
+			if (!windows.Allocate(nwindows, arena)) {
+				lasterror.assign(L"offset windows exceed memory limit");
+				return false;
+			}
+			std::fill(windows.data(), windows.data() + nwindows, 0U);
+			for (std::uint32_t i = 0; i < norsize; i++) {
+				auto off = tables.Offset(i);
+				if (off >= pre) {
+					lasterror.assign(L"object offset out of range: ").append(std::to_wstring(off));
 					return false;
-#endif
 				}
-				else if (size > warn) {
-					if (wfs.files.size() < wfs.limits) {
-						base::FileInfo fileinfo;
-						fileinfo.file = base::Sha1FromIndex(hIdx, i.offset);
-						fileinfo.size = size;
-						wfs.files.push_back(std::move(fileinfo));
+				windows[static_cast<std::size_t>(off >> shift)]++;
+			}
+			/// the window counts and the arena's first block share the memory limit with the positions
+			auto taken = nwindows * sizeof(std::uint32_t) + base::Arena::BlockSize;
+			auto room = wfs.memlimit > taken ? wfs.memlimit - taken : 0;
+			auto capacity = (std::min)(static_cast<std::size_t>(norsize), (std::max)(room / sizeof(std::uint32_t), static_cast<std::size_t>(1)));
+			base::Scratch<std::uint32_t> positions;
+			if (!positions.Allocate(capacity, arena)) {
+				lasterror.assign(L"offset window exceeds memory limit");
+				return false;
+			}
+			sorting.Stop();
+			auto hiw = nwindows;
+			while (hiw > 0) {
+				std::size_t low = hiw;
+				std::size_t inchunk = 0;
+				while (low > 0 && inchunk + windows[low - 1] <= capacity) {
+					inchunk += windows[--low];
+				}
+				if (low == hiw) {
+					lasterror.assign(L"offset window exceeds memory limit");
+					return false;
+				}
+				std::uint64_t lo = static_cast<std::uint64_t>(low) << shift;
+				std::uint64_t hi = static_cast<std::uint64_t>(hiw) << shift;
+				stats::Timer chunk(stats::Sort);
+				std::size_t npos = 0;
+				for (std::uint32_t i = 0; i < norsize && npos < inchunk; i++) {
+					auto off = tables.Offset(i);
+					if (off >= lo && off < hi) {
+						positions[npos++] = i;
 					}
-					wfs.counts++;
 				}
+				int top = 0;
+				while (top + 8 < 64 && ((hi - lo - 1) >> (top + 8)) != 0) {
+					top += 8;
+				}
+				RadixSort(positions.data(), npos, top, [&](std::uint32_t i) {
+					return tables.Offset(i) - lo;
+				});
+				chunk.Stop();
+				stats::Timer timer(stats::Review);
+				for (auto k = npos; k > 0; k--) {
+					auto i = positions[k - 1];
+					if (!account(i, tables.Offset(i), pre, limit, warn)) {
+						return false;
+					}
+				}
+				hiw = low;
 			}
 			return true;
 		}
-		bool reviewlarge(std::uint64_t limit, std::uint64_t warn) {
-			if (base::FileSeek(hIdx, 4 + 4 + norsize * (20 + 4) + 256 * 4, FILE_BEGIN)) {
+	private:
+		/// object i ends where the object after it starts (pre), walked high to low
+		bool account(std::uint32_t i, std::uint64_t off, std::uint64_t &pre, std::uint64_t limit, std::uint64_t warn) {
+			if (off >= pre) {
+				lasterror.assign(L"object offset out of order: ").append(std::to_wstring(off));
 				return false;
 			}
-			if ((norsize * sizeof(ObjectIndexLarge) + sizeof(std::uint64_t)*lasize) > wfs.memlimit) {
+			auto size = pre - off;
+			pre = off;
+			if (wfs.Interrupted(i)) {
+				lasterror.clear();
 				return false;
 			}
-			std::vector<ObjectIndexLarge> objs(norsize);
-			auto objsraw = objs.data();
-			auto bufc = reinterpret_cast<char *>(objsraw);
-			/// 4*counts
-			auto binteger = reinterpret_cast<std::uint32_t *>(
-				bufc + (sizeof(ObjectIndexLarge) - sizeof(std::uint32_t))* norsize);
-			if (!base::Readimpl(hIdx, binteger, norsize)) {
+			if (keep != nullptr && !(*keep)[i]) {
+				return true;
+			}
+			wfs.stats.Add(base::Histogram::Untyped, size, size);
+			if (size > limit) {
+				wchar_t hex[48];
+				console::Printeln(L"File: %ls size %4.2f MB, more than %4.2f MB",
+					base::Sha1FromIndex(tables.sha1, hex, i), (float)size / base::Megabyte,
+					(float)limit / base::Megabyte);
+				wfs.Reject(size, tables.sha1 + i * 20ULL);
+				if (wfs.StopOnLimit()) {
+					return false;
+				}
+			}
+			else if (size > warn) {
+				wfs.files.Push(size, tables.sha1 + i * 20ULL);
+				wfs.counts++;
+			}
+			return true;
+		}
+		/// every {offset, position} in memory, sorted high to low. 64-bit
+		/// entries only when the pack has a large offset table
+		template <typename IntegerT>
+		bool reviewsorted(std::uint64_t limit, std::uint64_t warn, base::Arena *arena) {
+			if (norsize * sizeof(object_base<IntegerT>) + sizeof(std::uint64_t) * lasize > wfs.memlimit) {
 				return false;
 			}
-			std::vector<std::uint64_t> lnrv(lasize);
-			if (!base::Readimpl(hIdx, lnrv.data(), lasize)) {
+			stats::Timer sorting(stats::Sort);
+			base::Scratch<object_base<IntegerT>> objs;
+			if (!objs.Allocate(norsize, arena)) {
+				lasterror.assign(L"object counts more than memory limit: ").append(std::to_wstring(norsize));
 				return false;
 			}
-			for (uint32_t i = 0; i < norsize; i++) {
-				/// DON'T  change the order of operations
-				auto off = ntohl(binteger[i]);
-				if (!(off & 0x80000000)) {
-					objsraw[i].offset = off;
-					objsraw[i].index = i;
-					continue;
-				}
-				off = off & 0x7fffffff;
-				if (off >= lasize) {
-					return false;
-				}
-				objsraw[i].offset = bswap64(lnrv[off]);
-				objsraw[i].index = i;
+			if (!DecodeOffsets(tables, objs.data())) {
+				lasterror.assign(L"large offset index out of range");
+				return false;
 			}
-			std::sort(objs.begin(), objs.end());
+			std::sort(objs.data(), objs.data() + norsize);
+			sorting.Stop();
+			stats::Timer timer(stats::Review);
 			std::uint64_t pre = pkflen - 20;
-			for (const auto &i : objs) {
-				auto size = pre - i.offset;
-				pre = i.offset;
-				if (size > limit) {
-					console::Printeln(L"File: %s size %4.2f MB, more than %4.2f MB",
-						base::Sha1FromIndex(hIdx, i.index), (float)size / base::Megabyte,
-						(float)limit / base::Megabyte);
-#if CHECKLIMIT_RETURN
+			for (std::uint32_t k = 0; k < norsize; k++) {
+				const auto &o = objs[k];
+				if (!account(o.index, o.offset, pre, limit, warn)) {
 					return false;
-#endif
-				}
-				else if (size > warn) {
-					if (wfs.files.size() < wfs.limits) {
-						base::FileInfo fileinfo;
-						fileinfo.file = base::Sha1FromIndex(hIdx, i.index);
-						fileinfo.size = size;
-						wfs.files.push_back(std::move(fileinfo));
-					}
-					wfs.counts++;
 				}
 			}
 			return true;
 		}
 		std::wstring lasterror;
-		HANDLE hIdx{ INVALID_HANDLE_VALUE };
+		base::MapView idx;
+		base::MapView rev;
+		IndexTables tables;
+		const std::uint8_t *revtable{ nullptr };
+		const std::vector<bool> *keep{ nullptr };
 		base::Wfs &wfs;
-		LARGE_INTEGER idxsize;
-		std::int64_t pkflen;
-		std::uint32_t norsize;
-		std::uint32_t lasize;
+		std::int64_t pkflen{ 0 };
+		std::uint32_t norsize{ 0 };
+		std::uint32_t lasize{ 0 };
 	};
 }
 
@@ -0,0 +1,102 @@
+#ifndef GIT_WAZE_INFLATE_HPP
+#define GIT_WAZE_INFLATE_HPP
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <zlib.h>
+
+namespace base {
+	/// A reusable zlib inflate state for reading the first bytes of a stream.
+	/// Object headers and delta size varints sit at the very start, so only a
+	/// few bytes are ever produced and large objects are never decompressed.
+	class Inflater {
+	public:
+		Inflater() {
+			memset(&zs, 0, sizeof(zs));
+			ok = inflateInit(&zs) == Z_OK;
+		}
+		Inflater(const Inflater &) = delete;
+		Inflater &operator=(const Inflater &) = delete;
+		~Inflater() {
+			if (ok) {
+				inflateEnd(&zs);
+			}
+		}
+		/// one per thread, reset for every stream it reads
+		static Inflater &Local() {
+			static thread_local Inflater z;
+			return z;
+		}
+		/// inflate into out until 'want' bytes are produced or the stream ends.
+		/// next(p, n) supplies the following input chunk, false when exhausted
+		template <typename SourceFn>
+		bool Peek(SourceFn &&next, std::uint8_t *out, std::size_t want, std::size_t &produced) {
+			produced = 0;
+			if (!ok || inflateReset(&zs) != Z_OK) {
+				return false;
+			}
+			zs.next_out = out;
+			zs.avail_out = static_cast<uInt>(want);
+			zs.avail_in = 0;
+			for (;;) {
+				if (zs.avail_in == 0) {
+					const std::uint8_t *p = nullptr;
+					std::size_t n = 0;
+					if (!next(p, n) || n == 0) {
+						return false;
+					}
+					zs.next_in = const_cast<Bytef *>(p);
+					zs.avail_in = static_cast<uInt>(n);
+				}
+				auto rc = inflate(&zs, Z_SYNC_FLUSH);
+				produced = want - zs.avail_out;
+				if (rc == Z_STREAM_END || zs.avail_out == 0) {
+					return true;
+				}
+				if (rc != Z_OK && rc != Z_BUF_ERROR) {
+					return false;
+				}
+			}
+		}
+		/// inflate a whole stream, out is reused for every chunk and sink(p, n)
+		/// hears about each one. next(p, n) supplies input; once the stream
+		/// ended, the last 'unused' bytes of the last input chunk were not part of it
+		template <typename SourceFn, typename SinkFn>
+		bool Drain(SourceFn &&next, SinkFn &&sink, std::uint8_t *out, std::size_t outsize, std::size_t &unused) {
+			unused = 0;
+			if (!ok || inflateReset(&zs) != Z_OK) {
+				return false;
+			}
+			zs.avail_in = 0;
+			for (;;) {
+				if (zs.avail_in == 0) {
+					const std::uint8_t *p = nullptr;
+					std::size_t n = 0;
+					if (!next(p, n) || n == 0) {
+						return false;
+					}
+					zs.next_in = const_cast<Bytef *>(p);
+					zs.avail_in = static_cast<uInt>(n);
+				}
+				zs.next_out = out;
+				zs.avail_out = static_cast<uInt>(outsize);
+				auto rc = inflate(&zs, Z_NO_FLUSH);
+				if (zs.avail_out != outsize) {
+					sink(out, outsize - zs.avail_out);
+				}
+				if (rc == Z_STREAM_END) {
+					unused = zs.avail_in;
+					return true;
+				}
+				if (rc != Z_OK && rc != Z_BUF_ERROR) {
+					return false;
+				}
+			}
+		}
+	private:
+		z_stream zs;
+		bool ok{ false };
+	};
+}
+
+#endif
@@ -0,0 +1,266 @@
+#ifndef GIT_WAZE_JOURNALFILE_HPP
+#define GIT_WAZE_JOURNALFILE_HPP
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "base.hpp"
+#include "cachefile.hpp"
+#include "checksum.hpp"
+
+#pragma once
+namespace cache {
+	/// --checkpoint journal: JournalHeader, then one record per pack or
+	/// repository as its scan completes. A record is a Record, the repository
+	/// name in UTF-8, a Histogram and Object[nfiles + nover], unaligned. The
+	/// CRC-32 covers all of it, so a record torn by a crash fails the check
+	/// and the journal is cut back to the record before
+	const constexpr std::uint32_t JournalMagic = 0x4a5a5747; /// 'GWZJ'
+	const constexpr std::uint32_t JournalVersion = 1;
+	struct JournalHeader {
+		std::uint32_t magic;
+		std::uint32_t version;
+		std::uint64_t limit;
+		std::uint64_t warn;
+		std::uint32_t topk;
+		std::uint32_t engine;
+	};
+	struct Record {
+		std::uint32_t crc; /// of the record with this field zero and what follows it
+		std::uint32_t kind;
+		Key key; /// pack records, the same key as the scan cache
+		std::uint64_t counts;
+		std::uint32_t namelen; /// repository records
+		std::uint32_t nfiles;
+		std::uint32_t nover;
+		std::uint32_t reserved;
+	};
+	static_assert(sizeof(JournalHeader) == 32 && sizeof(Record) == 80, "journal records are written as is");
+
+	/// Packs and repositories a scan completed, for a restarted scan to skip.
+	/// Records are written as soon as they are appended, so a killed process
+	/// loses none; fsync runs at most once per SyncInterval, so a crash of the
+	/// machine loses the last one at most. Lookups read what the journal held
+	/// when opened and are thread safe, as are appends. A run that completes
+	/// every repository removes the journal, the next one starts over
+	class Journal {
+	public:
+		enum : std::uint32_t {
+			Pack = 1,
+			Repository = 2
+		};
+		static constexpr std::chrono::seconds SyncInterval{ 1 };
+		Journal() = default;
+		Journal(const Journal &) = delete;
+		Journal &operator=(const Journal &) = delete;
+		~Journal() {
+			base::CloseFile(fd);
+		}
+		const auto &LastError() const {
+			return lasterror;
+		}
+		/// replay the records of an earlier run, a journal written with other
+		/// limits or another engine is started over
+		bool Open(const std::filesystem::path &file_, std::uint64_t limit, std::uint64_t warn, std::uint8_t engine) {
+			file = file_;
+			JournalHeader h;
+			memset(&h, 0, sizeof(h));
+			h.magic = JournalMagic;
+			h.version = JournalVersion;
+			h.limit = limit;
+			h.warn = warn;
+			h.topk = base::Wfs::MaxNumberOfDetails;
+			h.engine = engine;
+			std::uint64_t good = 0;
+			if (view.Open(file.wstring()) && view.size() != 0) {
+				std::uint32_t magic = 0;
+				if (view.Contains(0, sizeof(magic))) {
+					memcpy(&magic, view.data(), sizeof(magic));
+				}
+				if (magic != JournalMagic) {
+					lasterror.assign(L"not a git-waze journal");
+					view.Close();
+					return false;
+				}
+				if (view.Contains(0, sizeof(h)) && memcmp(view.data(), &h, sizeof(h)) == 0) {
+					good = Replay(sizeof(h));
+				}
+			}
+			if (good != view.size()) {
+				view.Close();
+				std::error_code ec;
+				std::filesystem::resize_file(file, good, ec);
+				if (ec) {
+					lasterror.assign(L"truncate: ").append(base::ToWide(ec.message()));
+					return false;
+				}
+				if (good != 0 && !view.Open(file.wstring())) {
+					lasterror.assign(L"open: ").append(base::SystemError());
+					return false;
+				}
+			}
+			fd = base::Openappend(file.wstring());
+			if (fd == base::InvalidFile) {
+				lasterror.assign(L"open: ").append(base::SystemError());
+				return false;
+			}
+			if (good == 0 && (!base::WriteAll(fd, &h, sizeof(h)) || !base::SyncFile(fd))) {
+				lasterror.assign(L"write: ").append(base::SystemError());
+				return false;
+			}
+			synced = std::chrono::steady_clock::now();
+			return true;
+		}
+		/// repositories and packs replayed from an earlier run
+		std::size_t Repositories() const {
+			return repositories.size();
+		}
+		std::size_t Packs() const {
+			return packs.size();
+		}
+		bool Restore(const Key &key, base::Wfs &out) const {
+			auto it = packs.find(key);
+			return it != packs.end() && Load(it->second, out);
+		}
+		bool Restore(std::wstring_view repository, base::Wfs &out) const {
+			auto it = repositories.find(base::ToNarrow(repository));
+			return it != repositories.end() && Load(it->second, out);
+		}
+		void Store(const Key &key, const base::Wfs &w) {
+			Append(Pack, key, std::string(), w);
+		}
+		void Store(std::wstring_view repository, const base::Wfs &w) {
+			Key key;
+			memset(&key, 0, sizeof(key));
+			Append(Repository, key, base::ToNarrow(repository), w);
+		}
+		/// a repository this run leaves unfinished, the journal is kept for it
+		void Incomplete() {
+			incomplete++;
+		}
+		/// the last sync, and the journal goes away once every repository is done
+		bool Close() {
+			std::lock_guard<std::mutex> lock(mu);
+			view.Close();
+			if (fd == base::InvalidFile) {
+				return lasterror.empty();
+			}
+			if (!base::SyncFile(fd) && lasterror.empty()) {
+				lasterror.assign(L"sync: ").append(base::SystemError());
+			}
+			base::CloseFile(fd);
+			fd = base::InvalidFile;
+			if (lasterror.empty() && incomplete == 0) {
+				std::error_code ec;
+				std::filesystem::remove(file, ec);
+			}
+			return lasterror.empty();
+		}
+	private:
+		/// index the records from offset on, returns where the intact ones end
+		std::uint64_t Replay(std::uint64_t offset) {
+			Record r;
+			while (view.Contains(offset, sizeof(r))) {
+				memcpy(&r, view.data() + offset, sizeof(r));
+				auto total = sizeof(r) + static_cast<std::uint64_t>(r.namelen) + sizeof(base::Histogram) +
+					(static_cast<std::uint64_t>(r.nfiles) + r.nover) * sizeof(Object);
+				if ((r.kind != Pack && r.kind != Repository) || !view.Contains(offset, total)) {
+					break;
+				}
+				auto crc = r.crc;
+				r.crc = 0;
+				auto sum = base::Crc32(0, reinterpret_cast<const std::uint8_t *>(&r), sizeof(r));
+				sum = base::Crc32(sum, view.data() + offset + sizeof(r), total - sizeof(r));
+				if (sum != crc) {
+					break;
+				}
+				if (r.kind == Pack) {
+					packs[r.key] = offset;
+				}
+				else {
+					repositories[std::string(reinterpret_cast<const char *>(view.data() + offset + sizeof(r)), r.namelen)] = offset;
+				}
+				offset += total;
+			}
+			return offset;
+		}
+		bool Load(std::uint64_t offset, base::Wfs &out) const {
+			Record r;
+			memcpy(&r, view.data() + offset, sizeof(r));
+			auto p = view.data() + offset + sizeof(r) + r.namelen;
+			base::Histogram hist;
+			memcpy(&hist, p, sizeof(hist));
+			p += sizeof(hist);
+			out.counts += static_cast<std::size_t>(r.counts);
+			out.stats.Merge(hist);
+			for (std::uint32_t i = 0; i < r.nfiles + r.nover; i++, p += sizeof(Object)) {
+				Object o;
+				memcpy(&o, p, sizeof(o));
+				if (i < r.nfiles) {
+					out.files.Push(cache::Load(o));
+				}
+				else {
+					out.overlimit.push_back(cache::Load(o));
+				}
+			}
+			return true;
+		}
+		void Append(std::uint32_t kind, const Key &key, const std::string &name, const base::Wfs &w) {
+			auto files = w.files.Sorted();
+			Record r;
+			memset(&r, 0, sizeof(r));
+			r.kind = kind;
+			r.key = key;
+			r.counts = w.counts;
+			r.namelen = static_cast<std::uint32_t>(name.size());
+			r.nfiles = static_cast<std::uint32_t>(files.size());
+			r.nover = static_cast<std::uint32_t>(w.overlimit.size());
+			std::vector<std::uint8_t> buf(sizeof(r));
+			buf.insert(buf.end(), name.begin(), name.end());
+			auto hist = reinterpret_cast<const std::uint8_t *>(&w.stats);
+			buf.insert(buf.end(), hist, hist + sizeof(base::Histogram));
+			auto object = [&](const base::LargeObject &lo) {
+				auto o = Dump(lo);
+				auto b = reinterpret_cast<const std::uint8_t *>(&o);
+				buf.insert(buf.end(), b, b + sizeof(o));
+			};
+			for (const auto &o : files) {
+				object(o);
+			}
+			for (const auto &o : w.overlimit) {
+				object(o);
+			}
+			memcpy(buf.data(), &r, sizeof(r));
+			r.crc = base::Crc32(0, buf.data(), buf.size());
+			memcpy(buf.data(), &r.crc, sizeof(r.crc));
+			std::lock_guard<std::mutex> lock(mu);
+			if (fd == base::InvalidFile) {
+				return;
+			}
+			if (!base::WriteAll(fd, buf.data(), buf.size())) {
+				lasterror.assign(L"write: ").append(base::SystemError());
+				base::CloseFile(fd);
+				fd = base::InvalidFile;
+				return;
+			}
+			auto now = std::chrono::steady_clock::now();
+			if (now - synced >= SyncInterval) {
+				base::SyncFile(fd);
+				synced = now;
+			}
+		}
+		std::filesystem::path file;
+		base::MapView view; /// the records replayed, appends go past its end
+		std::map<Key, std::uint64_t> packs; /// record offsets, the last record of a key wins
+		std::map<std::string, std::uint64_t> repositories;
+		std::wstring lasterror;
+		std::mutex mu;
+		base::FileHandle fd{ base::InvalidFile };
+		std::chrono::steady_clock::time_point synced;
+		std::atomic<std::size_t> incomplete{ 0 };
+	};
+}
+
+#endif
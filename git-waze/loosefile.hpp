@@ -0,0 +1,169 @@
+#ifndef GIT_WAZE_LOOSEFILE_HPP
+#define GIT_WAZE_LOOSEFILE_HPP
+#include <cstring>
+#include <filesystem>
+#include "base.hpp"
+#include "console.hpp"
+#include "inflate.hpp"
+#include "packfile.hpp"
+
+#pragma once
+namespace loose {
+	/// "commit " plus 20 digits plus NUL, anything longer is not a loose object
+	const constexpr std::size_t MaxHeaderSize = 32;
+
+	/// "<type> <decimal size>\0" at the start of the inflated object
+	inline bool ParseHeader(const std::uint8_t *p, std::size_t n, pack::ObjectHeader &h) {
+		auto end = static_cast<const std::uint8_t *>(memchr(p, 0, n));
+		auto sp = static_cast<const std::uint8_t *>(memchr(p, ' ', n));
+		if (end == nullptr || sp == nullptr || sp > end) {
+			return false;
+		}
+		std::string_view type(reinterpret_cast<const char *>(p), static_cast<std::size_t>(sp - p));
+		if (type == "blob") {
+			h.type = pack::Blob;
+		}
+		else if (type == "tree") {
+			h.type = pack::Tree;
+		}
+		else if (type == "commit") {
+			h.type = pack::Commit;
+		}
+		else if (type == "tag") {
+			h.type = pack::Tag;
+		}
+		else {
+			return false;
+		}
+		if (sp + 1 == end) {
+			return false;
+		}
+		std::uint64_t size = 0;
+		for (auto q = sp + 1; q < end; q++) {
+			if (*q < '0' || *q > '9' || size > (UINT64_MAX - 9) / 10) {
+				return false;
+			}
+			size = size * 10 + (*q - '0');
+		}
+		h.size = size;
+		h.length = static_cast<std::uint32_t>(end - p + 1);
+		return true;
+	}
+
+	/// objects/xx/<38 hex>, one directory per leading oid byte
+	class LooseAnalyzer {
+	public:
+		LooseAnalyzer(base::Wfs &wfs_, std::filesystem::path objpath_, const idx::PackedSet *packed_ = nullptr)
+			:wfs(wfs_), objpath(std::move(objpath_)), packed(packed_) {}
+		~LooseAnalyzer() = default;
+		const auto &LastError()const {
+			return lasterror;
+		}
+		bool review(std::uint64_t limitsize, std::uint64_t warnsize, bool inflate) {
+			return review(0, 256, limitsize, warnsize, inflate, wfs, lasterror);
+		}
+		/// review fan-out directories [first, last) into out. Object sizes from
+		/// the inflated header when inflate is set, else on-disk file sizes.
+		/// Unreadable objects are reported and skipped, the result tells whether
+		/// any was met
+		bool review(unsigned first, unsigned last, std::uint64_t limitsize, std::uint64_t warnsize,
+			bool inflate, base::Wfs &out, std::wstring &err) {
+			stats::Timer timer(stats::Loose);
+			bool result = true;
+			std::uint64_t seen = 0;
+			wchar_t dir[3] = { 0 };
+			for (auto d = first; d < last; d++) {
+				dir[0] = static_cast<wchar_t>(base::hex::digits[d >> 4]);
+				dir[1] = static_cast<wchar_t>(base::hex::digits[d & 0xf]);
+				std::error_code ec;
+				std::filesystem::directory_iterator it(objpath / dir, ec);
+				if (ec) {
+					continue;
+				}
+				for (const auto &e : it) {
+					if (out.Interrupted(seen++)) {
+						err.clear();
+						return false;
+					}
+					auto name = e.path().filename().wstring();
+					std::uint8_t oid[20];
+					oid[0] = static_cast<std::uint8_t>(d);
+					if (name.size() != 38 || !base::HexDecode(name.data(), 19, oid + 1)) {
+						continue; /// tmp_obj_* and friends
+					}
+					if (packed != nullptr && packed->Contains(oid)) {
+						continue; /// packed since, the pack scan counts it
+					}
+					base::LargeObject lo;
+					memcpy(lo.oid, oid, 20);
+					if (!ObjectSize(e, inflate, lo)) {
+						err.assign(L"bad loose object ").append(e.path().wstring());
+						console::Printeln(L"Loose: %ls", err);
+						result = false;
+						continue;
+					}
+					out.stats.Add(lo.type, lo.size, lo.disk);
+					auto sz = lo.size;
+					if (sz > limitsize) {
+						wchar_t hex[48];
+						console::Printeln(L"File: %ls size %4.2f MB, more than %4.2f MB",
+							base::Sha1Hex(oid, hex), (float)sz / base::Megabyte,
+							(float)limitsize / base::Megabyte);
+						out.overlimit.push_back(lo);
+						if (out.StopOnLimit()) {
+							return false;
+						}
+					}
+					else if (sz > warnsize) {
+						out.files.Push(lo);
+						out.counts++;
+					}
+				}
+			}
+			return result;
+		}
+	private:
+		bool ObjectSize(const std::filesystem::directory_entry &e, bool inflate, base::LargeObject &lo) {
+			if (!inflate) {
+				std::error_code ec;
+				lo.size = lo.disk = e.file_size(ec);
+				return !ec;
+			}
+			auto fd = base::Openreadonly(e.path().wstring());
+			if (fd == base::InvalidFile) {
+				return false;
+			}
+			auto disk = base::Filesize(fd);
+			std::uint64_t offset = 0;
+			std::uint8_t in[256];
+			auto next = [&](const std::uint8_t *&p, std::size_t &n) {
+				auto r = base::ReadAt(fd, offset, in, sizeof(in));
+				if (r <= 0) {
+					return false;
+				}
+				offset += static_cast<std::uint64_t>(r);
+				p = in;
+				n = static_cast<std::size_t>(r);
+				return true;
+			};
+			std::uint8_t out[MaxHeaderSize];
+			std::size_t produced = 0;
+			auto r = base::Inflater::Local().Peek(next, out, sizeof(out), produced);
+			base::CloseFile(fd);
+			pack::ObjectHeader h;
+			if (!r || disk < 0 || !ParseHeader(out, produced, h)) {
+				return false;
+			}
+			lo.size = lo.inflated = h.size;
+			lo.disk = static_cast<std::uint64_t>(disk);
+			lo.type = h.type;
+			return true;
+		}
+		std::wstring lasterror;
+		base::Wfs &wfs;
+		std::filesystem::path objpath;
+		const idx::PackedSet *packed{ nullptr };
+	};
+}
+
+#endif
@@ -0,0 +1,427 @@
+#ifndef GIT_WAZE_MIDXFILE_HPP
+#define GIT_WAZE_MIDXFILE_HPP
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "base.hpp"
+#include "console.hpp"
+#include "idxfile.hpp"
+#include "packfile.hpp"
+
+#pragma once
+namespace midx {
+	/// objects/pack/multi-pack-index: 'MIDX' version hashid chunks bases packs,
+	/// chunk lookup table, chunks, checksum
+	struct MidxTables {
+		const std::uint8_t *fanout{ nullptr };
+		const std::uint8_t *oids{ nullptr };
+		const std::uint8_t *offsets{ nullptr }; /// pack-int-id, offset
+		const std::uint8_t *largeoffsets{ nullptr };
+		const std::uint8_t *revindex{ nullptr }; /// RIDX chunk, pseudo-pack order
+		std::vector<std::wstring> packs; /// PNAM, sorted idx names
+		std::uint32_t count{ 0 };
+		std::uint32_t lasize{ 0 };
+		std::uint32_t Pack(std::uint32_t i) const {
+			return base::LoadBE32(offsets + i * 8ULL);
+		}
+		/// UINT64_MAX when the large offset index is out of range
+		std::uint64_t Offset(std::uint32_t i) const {
+			auto off = base::LoadBE32(offsets + i * 8ULL + 4);
+			if (!(off & 0x80000000)) {
+				return off;
+			}
+			off = off & 0x7fffffff;
+			if (largeoffsets == nullptr || off >= lasize) {
+				return UINT64_MAX;
+			}
+			return base::LoadBE64(largeoffsets + off * 8ULL);
+		}
+	};
+
+	inline bool ParseMidx(const base::MapView &view, MidxTables &tables) {
+		constexpr std::uint64_t headsize = 4 * 3;
+		constexpr std::uint32_t PNAM = 0x504e414d;
+		constexpr std::uint32_t OIDF = 0x4f494446;
+		constexpr std::uint32_t OIDL = 0x4f49444c;
+		constexpr std::uint32_t OOFF = 0x4f4f4646;
+		constexpr std::uint32_t LOFF = 0x4c4f4646;
+		constexpr std::uint32_t RIDX = 0x52494458;
+		if (!view.Contains(0, headsize + 20)) {
+			return false;
+		}
+		auto p = view.data();
+		/// version 1 and 2 share the chunk layout, hash 1 is sha1, no incremental bases
+		if (base::LoadBE32(p) != 0x4d494458 || (p[4] != 1 && p[4] != 2) || p[5] != 1 || p[7] != 0) {
+			return false;
+		}
+		std::uint32_t chunks = p[6];
+		std::uint32_t npacks = base::LoadBE32(p + 8);
+		if (!view.Contains(headsize, (chunks + 1) * 12ULL + 20)) {
+			return false;
+		}
+		/// chunk i spans [offset(i), offset(i+1)), the last entry is the terminator
+		const std::uint8_t *pnam = nullptr;
+		std::uint64_t pnamsize = 0;
+		std::uint64_t oidlsize = 0, ooffsize = 0, loffsize = 0, ridxsize = 0;
+		for (std::uint32_t c = 0; c < chunks; c++) {
+			auto e = p + headsize + c * 12ULL;
+			auto id = base::LoadBE32(e);
+			auto begin = base::LoadBE64(e + 4);
+			auto end = base::LoadBE64(e + 12 + 4);
+			if (begin > end || !view.Contains(begin, end - begin)) {
+				return false;
+			}
+			auto chunk = p + begin;
+			switch (id) {
+			case PNAM:
+				pnam = chunk;
+				pnamsize = end - begin;
+				break;
+			case OIDF:
+				if (end - begin != 256 * 4) {
+					return false;
+				}
+				tables.fanout = chunk;
+				break;
+			case OIDL:
+				tables.oids = chunk;
+				oidlsize = end - begin;
+				break;
+			case OOFF:
+				tables.offsets = chunk;
+				ooffsize = end - begin;
+				break;
+			case LOFF:
+				tables.largeoffsets = chunk;
+				loffsize = end - begin;
+				break;
+			case RIDX:
+				tables.revindex = chunk;
+				ridxsize = end - begin;
+				break;
+			default:
+				break;
+			}
+		}
+		if (pnam == nullptr || tables.fanout == nullptr || tables.oids == nullptr || tables.offsets == nullptr) {
+			return false;
+		}
+		tables.count = base::LoadBE32(tables.fanout + 4 * 255);
+		std::uint64_t nr = tables.count;
+		if (oidlsize != nr * 20 || ooffsize != nr * 8) {
+			return false;
+		}
+		if (tables.revindex != nullptr && ridxsize != nr * 4) {
+			tables.revindex = nullptr;
+		}
+		tables.lasize = static_cast<std::uint32_t>(loffsize / 8);
+		/// NUL terminated names, the chunk may be padded with extra NULs
+		std::uint64_t pos = 0;
+		while (tables.packs.size() < npacks) {
+			auto name = reinterpret_cast<const char *>(pnam + pos);
+			auto len = strnlen(name, static_cast<std::size_t>(pnamsize - pos));
+			if (len == 0 || pos + len >= pnamsize) {
+				return false;
+			}
+			tables.packs.push_back(base::ToWide(std::string_view(name, len)));
+			pos += len + 1;
+		}
+		return true;
+	}
+
+	/// Scan every object of the multi-pack-index once, in pseudo-pack order when
+	/// the midx carries a reverse index. Duplicates across packs were already
+	/// resolved by git when it wrote the midx. An entry's bytes on disk run to
+	/// the next entry of its pack, copies the midx did not pick included, so
+	/// each covered pack's own idx orders its entries
+	class MidxAnalyzer {
+	public:
+		MidxAnalyzer(base::Wfs &wfs_) :wfs(wfs_) {}
+		~MidxAnalyzer() = default;
+		const auto &LastError()const {
+			return lasterror;
+		}
+		bool resolve(std::wstring_view packdir) {
+			stats::Timer timer(stats::Verify);
+			auto file = std::wstring(packdir).append(L"/multi-pack-index");
+			if (!view.Open(file)) {
+				lasterror.assign(L"open multi-pack-index: ").append(base::SystemError());
+				return false;
+			}
+			if (!ParseMidx(view, tables)) {
+				lasterror.assign(L"invalid multi-pack-index: ").append(file);
+				return false;
+			}
+			if (tables.revindex != nullptr) {
+				revtable = tables.revindex;
+			}
+			else {
+				/// git before 2.41 writes the reverse index next to the midx
+				wchar_t hex[48];
+				auto ridf = std::wstring(packdir).append(L"/multi-pack-index-")
+					.append(base::Sha1Hex(view.data() + view.size() - 20, hex)).append(L".rev");
+				if (rev.Open(ridf)) {
+					revtable = idx::ParseReverseIndex(rev, tables.count);
+				}
+			}
+			for (const auto &name : tables.packs) {
+				if (name.size() < 4 || name.compare(name.size() - 4, 4, L".idx") != 0) {
+					lasterror.assign(L"invalid pack name in multi-pack-index: ").append(name);
+					return false;
+				}
+				auto stem = std::wstring(packdir).append(L"/").append(name, 0, name.size() - 3);
+				packs.emplace_back(new Covered);
+				auto &c = *packs.back();
+				if (!c.pk.Open(stem + L"pack")) {
+					lasterror.assign(L"open packfile: ").append(base::SystemError());
+					return false;
+				}
+				if (!c.index.Open(stem + L"idx")) {
+					lasterror.assign(L"open idxfile: ").append(base::SystemError());
+					return false;
+				}
+				if (!idx::ParseIndex(c.index, c.tables)) {
+					lasterror.assign(L"invalid idxfile: ").append(stem).append(L"idx");
+					return false;
+				}
+				if (c.rev.Open(stem + L"rev")) {
+					c.revtable = idx::ParseReverseIndex(c.rev, c.tables.norsize);
+				}
+			}
+			return true;
+		}
+		/// pack file names covered by the midx, such packs need no scan of their own
+		bool Covers(std::wstring_view packname) const {
+			return PackId(packname) < tables.packs.size();
+		}
+		const MidxTables &Tables() const {
+			return tables;
+		}
+		/// objects the midx chose from the pack whose idx tables are given, by a
+		/// merge of the two sorted oid lists
+		bool Selected(std::wstring_view packname, const idx::IndexTables &it, std::vector<bool> &keep) const {
+			auto id = PackId(packname);
+			if (id >= tables.packs.size()) {
+				return false;
+			}
+			keep.assign(it.norsize, false);
+			std::uint32_t j = 0;
+			for (std::uint32_t i = 0; i < it.norsize; i++) {
+				auto oid = it.sha1 + i * 20ULL;
+				int c = -1;
+				while (j < tables.count && (c = memcmp(tables.oids + j * 20ULL, oid, 20)) < 0) {
+					j++;
+				}
+				if (j < tables.count && c == 0) {
+					keep[i] = tables.Pack(j) == id;
+				}
+			}
+			return true;
+		}
+		bool Splittable() const {
+			for (const auto &c : packs) {
+				if (!c->pk.Mapped()) {
+					return false;
+				}
+			}
+			return true;
+		}
+		std::uint32_t ObjectCount() const {
+			return tables.count;
+		}
+		/// Entry offsets of every covered pack in pack order, read off its .rev
+		/// or sorted from its idx as PackAnalyzer::prepare does, and the same
+		/// two bytes per entry memoizing what its delta chain resolves to.
+		/// Without a reverse index for the midx itself objects are visited in
+		/// oid order
+		bool prepare() {
+			stats::Timer timer(stats::Sort);
+			std::uint64_t objects = 0;
+			for (const auto &c : packs) {
+				objects += c->tables.norsize;
+			}
+			if (objects * (sizeof(std::uint64_t) + sizeof(pack::Memo)) > wfs.memlimit) {
+				lasterror.assign(L"object counts more than memory limit: ").append(std::to_wstring(objects));
+				return false;
+			}
+			for (auto &cp : packs) {
+				auto &c = *cp;
+				auto n = c.tables.norsize;
+				if (!c.order.Allocate(n, nullptr) || !c.types.Allocate(n, nullptr)) {
+					lasterror.assign(L"object counts more than memory limit: ").append(std::to_wstring(n));
+					return false;
+				}
+				for (std::uint32_t k = 0; k < n; k++) {
+					c.types[k].store(0, std::memory_order_relaxed);
+				}
+				for (std::uint32_t k = 0; k < n; k++) {
+					auto i = c.revtable != nullptr ? base::LoadBE32(c.revtable + k * 4ULL) : k;
+					if (i >= n) {
+						lasterror.assign(L"reverse index out of range: ").append(std::to_wstring(i));
+						return false;
+					}
+					c.order[k] = c.tables.Offset(i);
+					if (c.order[k] == UINT64_MAX) {
+						lasterror.assign(L"large offset out of range: ").append(std::to_wstring(i));
+						return false;
+					}
+				}
+				if (c.revtable == nullptr) {
+					std::sort(c.order.data(), c.order.data() + n);
+				}
+			}
+			return true;
+		}
+		bool review(std::uint64_t limitsize, std::uint64_t warnsize) {
+			if (!prepare()) {
+				return false;
+			}
+			return review(0, tables.count, limitsize, warnsize, wfs, lasterror);
+		}
+		/// review objects [first, last) into out. Needs prepare, safe to call
+		/// concurrently on disjoint ranges when Splittable()
+		bool review(std::uint32_t first, std::uint32_t last, std::uint64_t limitsize, std::uint64_t warnsize,
+			base::Wfs &out, std::wstring &err) {
+			stats::Timer timer(stats::PackRead);
+			for (auto k = first; k < last; k++) {
+				if (out.Interrupted(k - first)) {
+					err.clear();
+					return false;
+				}
+				auto i = revtable != nullptr ? base::LoadBE32(revtable + k * 4ULL) : k;
+				if (i >= tables.count) {
+					err.assign(L"reverse index out of range: ").append(std::to_wstring(i));
+					return false;
+				}
+				auto id = tables.Pack(i);
+				if (id >= packs.size()) {
+					err.assign(L"pack id out of range: ").append(std::to_wstring(id));
+					return false;
+				}
+				auto offset = tables.Offset(i);
+				auto &c = *packs[id];
+				auto &pk = c.pk;
+				const auto end = pk.size() - 20;
+				/// an entry ends where the next one of its pack starts
+				auto n = c.tables.norsize;
+				auto pos = Position(c, offset);
+				auto next = pos + 1 < n ? c.order[pos + 1] : end;
+				pack::ObjectHeader h;
+				pack::DeltaRef ref;
+				std::uint64_t sz = 0;
+				if (pos >= n || next <= offset || next > end || !pack::ReadEntry(pk, offset, h, ref) ||
+					!pack::ResolvedSize(pk, h, ref, sz)) {
+					err.assign(L"bad object at offset ").append(std::to_wstring(offset))
+						.append(L" in ").append(tables.packs[id]);
+					return false;
+				}
+				/// chain depths would need a walk per delta, the midx has no memo
+				auto rs = Type(c, pos, offset, h, ref);
+				out.stats.Add(h.type, h.size, next - offset);
+				if (pack::IsDelta(h.type) && rs.type != pack::None) {
+					out.stats.AddDepth(rs.depth);
+				}
+				if (sz <= warnsize) {
+					continue;
+				}
+				base::LargeObject lo;
+				lo.size = sz;
+				lo.disk = next - offset;
+				lo.inflated = h.size;
+				lo.type = rs.type;
+				memcpy(lo.oid, tables.oids + i * 20ULL, 20);
+				if (sz > limitsize) {
+					wchar_t hex[48];
+					console::Printeln(L"File: %ls size %4.2f MB, more than %4.2f MB",
+						base::Sha1Hex(lo.oid, hex), (float)sz / base::Megabyte,
+						(float)limitsize / base::Megabyte);
+					out.overlimit.push_back(lo);
+					if (out.StopOnLimit()) {
+						return false;
+					}
+				}
+				else {
+					out.files.Push(lo);
+					out.counts++;
+				}
+			}
+			return true;
+		}
+	private:
+		/// one pack the midx covers, with its own idx and .rev
+		struct Covered {
+			pack::PackView pk;
+			base::MapView index;
+			base::MapView rev;
+			idx::IndexTables tables;
+			const std::uint8_t *revtable{ nullptr };
+			base::Scratch<std::uint64_t> order; /// entry offsets in pack order, built by prepare
+			base::Scratch<std::atomic<pack::Memo>> types; /// by pack order position
+		};
+		/// pack order position of the entry at offset, norsize when there is none
+		static std::uint32_t Position(const Covered &c, std::uint64_t offset) {
+			auto n = c.tables.norsize;
+			auto it = std::lower_bound(c.order.data(), c.order.data() + n, offset);
+			return it != c.order.data() + n && *it == offset ? static_cast<std::uint32_t>(it - c.order.data()) : n;
+		}
+		/// type and chain depth of the entry at pack order position pos, chains
+		/// memoized per pack as in PackAnalyzer::Type. REF_DELTA bases are looked
+		/// up in the pack's own idx, copies the midx did not pick included
+		pack::Resolved Type(Covered &c, std::uint32_t pos, std::uint64_t offset, const pack::ObjectHeader &h,
+			const pack::DeltaRef &ref) {
+			if (!pack::IsDelta(h.type)) {
+				c.types[pos].store(h.type, std::memory_order_relaxed);
+				return pack::Resolved{ h.type, 0 };
+			}
+			auto t = pack::LoadMemo(c.types[pos].load(std::memory_order_relaxed));
+			if (t.type != pack::None) {
+				return t;
+			}
+			auto lookup = [&](const std::uint8_t *oid, std::uint64_t &base) {
+				auto i = c.tables.Find(oid);
+				if (i == UINT32_MAX) {
+					return false; /// thin pack, the base lives elsewhere
+				}
+				base = c.tables.Offset(i);
+				return true;
+			};
+			auto memo = [&](std::uint64_t base) {
+				auto k = Position(c, base);
+				return k < c.tables.norsize ? pack::LoadMemo(c.types[k].load(std::memory_order_relaxed)) : pack::Resolved{};
+			};
+			auto visit = [&](std::uint64_t off, const pack::Resolved &r) {
+				auto k = Position(c, off);
+				if (k < c.tables.norsize) {
+					c.types[k].store(pack::SaveMemo(r), std::memory_order_relaxed);
+				}
+			};
+			t = pack::ResolveType(c.pk, offset, h, ref, lookup, memo, visit);
+			c.types[pos].store(pack::SaveMemo(t), std::memory_order_relaxed);
+			return t;
+		}
+		/// PNAM lists 'pack-<hash>.idx', callers hold 'pack-<hash>.pack'
+		std::size_t PackId(std::wstring_view packname) const {
+			if (packname.size() < 5) {
+				return tables.packs.size();
+			}
+			auto stem = packname.substr(0, packname.size() - 4);
+			for (std::size_t id = 0; id < tables.packs.size(); id++) {
+				const auto &name = tables.packs[id];
+				if (name.size() == stem.size() + 3 && name.compare(0, stem.size(), stem) == 0) {
+					return id;
+				}
+			}
+			return tables.packs.size();
+		}
+		base::MapView view;
+		base::MapView rev;
+		MidxTables tables;
+		const std::uint8_t *revtable{ nullptr };
+		std::vector<std::unique_ptr<Covered>> packs;
+		std::wstring lasterror;
+		base::Wfs &wfs;
+	};
+}
+
+#endif
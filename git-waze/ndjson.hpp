@@ -0,0 +1,203 @@
+#ifndef GIT_WAZE_NDJSON_HPP
+#define GIT_WAZE_NDJSON_HPP
+#include <cstring>
+#include <string_view>
+#include <vector>
+#include "base.hpp"
+#include "hexencode.hpp"
+
+#pragma once
+namespace report {
+	/// One JSON object per line into a reusable buffer that goes out with a
+	/// single write once it fills. Numbers, oids and strings are formatted in
+	/// place, wide strings become UTF-8 as they are escaped: a record costs no
+	/// allocation and no wide char round trip.
+	class NdjsonWriter {
+	public:
+		enum {
+			Capacity = 1 << 16
+		};
+		explicit NdjsonWriter(base::FileHandle fd_) :fd(fd_), buf(Capacity) {}
+		NdjsonWriter(const NdjsonWriter &) = delete;
+		NdjsonWriter &operator=(const NdjsonWriter &) = delete;
+		~NdjsonWriter() {
+			Flush();
+		}
+		/// {"type":"<type>"
+		NdjsonWriter &Begin(std::string_view type) {
+			Append("{\"type\":\"", 9);
+			Append(type.data(), type.size());
+			Put('"');
+			return *this;
+		}
+		NdjsonWriter &Number(std::string_view key, std::uint64_t v) {
+			Key(key);
+			Digits(v);
+			return *this;
+		}
+		NdjsonWriter &Boolean(std::string_view key, bool v) {
+			Key(key);
+			if (v) {
+				Append("true", 4);
+			}
+			else {
+				Append("false", 5);
+			}
+			return *this;
+		}
+		/// UTF-8 input, escaped
+		NdjsonWriter &String(std::string_view key, std::string_view v) {
+			Key(key);
+			Put('"');
+			for (auto c : v) {
+				Escaped(static_cast<std::uint32_t>(static_cast<unsigned char>(c)));
+			}
+			Put('"');
+			return *this;
+		}
+		/// UTF-16 on Windows, UTF-32 elsewhere, encoded while escaped
+		NdjsonWriter &String(std::string_view key, std::wstring_view v) {
+			Key(key);
+			Put('"');
+			for (std::size_t i = 0; i < v.size(); i++) {
+				auto cp = static_cast<std::uint32_t>(v[i]);
+				if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < v.size()) {
+					auto lo = static_cast<std::uint32_t>(v[i + 1]);
+					if (lo >= 0xDC00 && lo <= 0xDFFF) {
+						cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+						i++;
+					}
+				}
+				Utf8(cp);
+			}
+			Put('"');
+			return *this;
+		}
+		/// 40 lowercase hex digits
+		NdjsonWriter &Oid(std::string_view key, const std::uint8_t *oid) {
+			Key(key);
+			Reserve(42);
+			buf[len++] = '"';
+			base::HexEncode(oid, 20, buf.data() + len);
+			len += 40;
+			buf[len++] = '"';
+			return *this;
+		}
+		/// "key":[[a,b],...] built with Pair between BeginPairs and EndPairs
+		NdjsonWriter &BeginPairs(std::string_view key) {
+			Key(key);
+			Put('[');
+			first = true;
+			return *this;
+		}
+		NdjsonWriter &Pair(std::uint64_t a, std::uint64_t b) {
+			if (!first) {
+				Put(',');
+			}
+			first = false;
+			Put('[');
+			Digits(a);
+			Put(',');
+			Digits(b);
+			Put(']');
+			return *this;
+		}
+		NdjsonWriter &EndPairs() {
+			Put(']');
+			return *this;
+		}
+		/// close the record, a full buffer goes out here and only here
+		void End() {
+			Append("}\n", 2);
+			if (len >= Capacity - Capacity / 8) {
+				Flush();
+			}
+		}
+		bool Flush() {
+			if (len == 0) {
+				return ok;
+			}
+			ok = base::WriteAll(fd, buf.data(), len) && ok;
+			len = 0;
+			return ok;
+		}
+	private:
+		/// grows only for records larger than the buffer, such as huge paths
+		void Reserve(std::size_t n) {
+			if (len + n > buf.size()) {
+				buf.resize((std::max)(buf.size() * 2, len + n));
+			}
+		}
+		void Put(char c) {
+			Reserve(1);
+			buf[len++] = c;
+		}
+		void Append(const char *p, std::size_t n) {
+			Reserve(n);
+			memcpy(buf.data() + len, p, n);
+			len += n;
+		}
+		void Key(std::string_view key) {
+			Reserve(key.size() + 4);
+			buf[len++] = ',';
+			buf[len++] = '"';
+			memcpy(buf.data() + len, key.data(), key.size());
+			len += key.size();
+			buf[len++] = '"';
+			buf[len++] = ':';
+		}
+		void Digits(std::uint64_t v) {
+			char tmp[20];
+			auto p = tmp + sizeof(tmp);
+			do {
+				*--p = static_cast<char>('0' + v % 10);
+				v /= 10;
+			} while (v != 0);
+			Append(p, static_cast<std::size_t>(tmp + sizeof(tmp) - p));
+		}
+		/// quote, backslash and control characters, everything else as is
+		void Escaped(std::uint32_t c) {
+			if (c == '"' || c == '\\') {
+				Put('\\');
+				Put(static_cast<char>(c));
+				return;
+			}
+			if (c < 0x20) {
+				char esc[6] = { '\\', 'u', '0', '0', base::hex::digits[c >> 4], base::hex::digits[c & 0xf] };
+				Append(esc, sizeof(esc));
+				return;
+			}
+			Put(static_cast<char>(c));
+		}
+		void Utf8(std::uint32_t cp) {
+			if (cp < 0x80) {
+				Escaped(cp);
+				return;
+			}
+			if ((cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF) {
+				cp = 0xFFFD; /// lone surrogate or out of range
+			}
+			Reserve(4);
+			if (cp < 0x800) {
+				buf[len++] = static_cast<char>(0xC0 | (cp >> 6));
+			}
+			else if (cp < 0x10000) {
+				buf[len++] = static_cast<char>(0xE0 | (cp >> 12));
+				buf[len++] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			}
+			else {
+				buf[len++] = static_cast<char>(0xF0 | (cp >> 18));
+				buf[len++] = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+				buf[len++] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			}
+			buf[len++] = static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		base::FileHandle fd;
+		std::vector<char> buf;
+		std::size_t len{ 0 };
+		bool first{ true };
+		bool ok{ true };
+	};
+}
+
+#endif
@@ -0,0 +1,350 @@
+#ifndef GIT_WAZE_OBJECTSTORE_HPP
+#define GIT_WAZE_OBJECTSTORE_HPP
+#include <cstring>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "base.hpp"
+#include "idxfile.hpp"
+#include "inflate.hpp"
+#include "loosefile.hpp"
+#include "packfile.hpp"
+
+#pragma once
+namespace odb {
+	struct OidKey {
+		std::uint8_t b[20];
+		OidKey() = default;
+		explicit OidKey(const std::uint8_t *oid) {
+			memcpy(b, oid, 20);
+		}
+		bool operator==(const OidKey &o) const {
+			return memcmp(b, o.b, 20) == 0;
+		}
+	};
+	/// oids are uniformly distributed, their first bytes hash well enough
+	struct OidHash {
+		std::size_t operator()(const OidKey &k) const {
+			std::uint64_t v;
+			memcpy(&v, k.b, sizeof(v));
+			return static_cast<std::size_t>(v);
+		}
+	};
+	typedef std::unordered_set<OidKey, OidHash> OidSet;
+
+	/// base size and result size, then copy-from-base and insert instructions
+	inline bool ApplyDelta(const std::uint8_t *base, std::size_t basesize, const std::uint8_t *delta, std::size_t n,
+		std::vector<std::uint8_t> &out) {
+		auto p = delta;
+		auto end = delta + n;
+		std::uint64_t sizes[2];
+		for (auto &sz : sizes) {
+			std::uint64_t v = 0;
+			unsigned shift = 0;
+			std::uint8_t c = 0;
+			do {
+				if (p >= end || shift > 63) {
+					return false;
+				}
+				c = *p++;
+				v |= static_cast<std::uint64_t>(c & 0x7f) << shift;
+				shift += 7;
+			} while (c & 0x80);
+			sz = v;
+		}
+		if (sizes[0] != basesize) {
+			return false;
+		}
+		out.resize(static_cast<std::size_t>(sizes[1]));
+		std::size_t pos = 0;
+		while (p < end) {
+			auto c = *p++;
+			if (c & 0x80) {
+				std::uint64_t offset = 0;
+				std::uint64_t size = 0;
+				for (unsigned i = 0; i < 4; i++) {
+					if (c & (1U << i)) {
+						if (p >= end) {
+							return false;
+						}
+						offset |= static_cast<std::uint64_t>(*p++) << (i * 8);
+					}
+				}
+				for (unsigned i = 0; i < 3; i++) {
+					if (c & (0x10U << i)) {
+						if (p >= end) {
+							return false;
+						}
+						size |= static_cast<std::uint64_t>(*p++) << (i * 8);
+					}
+				}
+				if (size == 0) {
+					size = 0x10000;
+				}
+				if (offset + size > basesize || pos + size > out.size()) {
+					return false;
+				}
+				memcpy(out.data() + pos, base + offset, static_cast<std::size_t>(size));
+				pos += static_cast<std::size_t>(size);
+			}
+			else if (c != 0) {
+				if (static_cast<std::size_t>(end - p) < c || pos + c > out.size()) {
+					return false;
+				}
+				memcpy(out.data() + pos, p, c);
+				p += c;
+				pos += c;
+			}
+			else {
+				return false; /// reserved
+			}
+		}
+		return pos == out.size();
+	}
+
+	struct Object {
+		std::uint8_t type{ pack::None };
+		std::vector<std::uint8_t> data;
+	};
+	typedef std::shared_ptr<const Object> ObjectPtr;
+
+	/// Decoded objects by oid, the least recently used go once the cached
+	/// bytes pass the capacity. Objects larger than a quarter of it are not kept
+	class ObjectCache {
+	public:
+		explicit ObjectCache(std::size_t capacity_) :capacity(capacity_) {}
+		ObjectPtr Get(const std::uint8_t *oid) {
+			auto it = index.find(OidKey(oid));
+			if (it == index.end()) {
+				stats::Add(stats::ObjectCacheMisses);
+				return nullptr;
+			}
+			stats::Add(stats::ObjectCacheHits);
+			lru.splice(lru.begin(), lru, it->second);
+			return it->second->second;
+		}
+		void Put(const std::uint8_t *oid, ObjectPtr o) {
+			auto size = o->data.size();
+			if (size > capacity / 4) {
+				return;
+			}
+			OidKey key(oid);
+			if (index.find(key) != index.end()) {
+				return;
+			}
+			lru.emplace_front(key, std::move(o));
+			index.emplace(key, lru.begin());
+			used += size;
+			while (used > capacity && !lru.empty()) {
+				used -= lru.back().second->data.size();
+				index.erase(lru.back().first);
+				lru.pop_back();
+			}
+		}
+	private:
+		typedef std::list<std::pair<OidKey, ObjectPtr>> List;
+		List lru;
+		std::unordered_map<OidKey, List::iterator, OidHash> index;
+		std::size_t used{ 0 };
+		std::size_t capacity;
+	};
+
+	/// Whole objects out of the packs and loose files of one objects
+	/// directory, deltas applied. Every object read goes through the cache, so
+	/// a delta base shared by a chain is inflated once
+	class ObjectStore {
+	public:
+		explicit ObjectStore(std::size_t cachebytes) :cache(cachebytes) {}
+		bool Open(const std::filesystem::path &objpath_) {
+			objpath = objpath_;
+			std::error_code ec;
+			for (auto &e : std::filesystem::directory_iterator(objpath / L"pack", ec)) {
+				if (e.path().extension().compare(L".pack") != 0) {
+					continue;
+				}
+				auto file = e.path().wstring();
+				std::unique_ptr<Pack> p(new Pack);
+				auto idf = std::wstring(file.substr(0, file.size() - sizeof("pack") + 1));
+				if (!p->index.Open(idf + L"idx") || !p->pk.Open(file)) {
+					continue;
+				}
+				p->tables = p->index.Tables();
+				if (p->rev.Open(idf + L"rev")) {
+					p->revtable = idx::ParseReverseIndex(p->rev, p->tables.norsize);
+				}
+				packs.push_back(std::move(p));
+			}
+			return true;
+		}
+		/// nullptr when the object is missing or every copy of it is broken
+		ObjectPtr Read(const std::uint8_t *oid) {
+			entries = 0;
+			return Read(oid, 0);
+		}
+	private:
+		struct Pack {
+			idx::Lookup index;
+			base::MapView rev;
+			idx::IndexTables tables;
+			pack::PackView pk;
+			const std::uint8_t *revtable{ nullptr };
+			std::vector<idx::ObjectIndexLarge> order; /// offset order without a .rev, built on first use
+		};
+		/// A broken copy falls through to the next pack that has the object,
+		/// then to the loose file. Bases found in another pack go on at
+		/// depth + 1, so a cycle of REF_DELTAs across packs ends at
+		/// MaxDeltaDepth; MaxEntries bounds the retries a cycle of
+		/// duplicated objects would multiply
+		ObjectPtr Read(const std::uint8_t *oid, std::uint32_t depth) {
+			if (auto o = cache.Get(oid)) {
+				return o;
+			}
+			for (auto &p : packs) {
+				auto i = p->tables.Find(oid);
+				if (i == UINT32_MAX) {
+					continue;
+				}
+				if (auto o = ReadPacked(*p, i, depth)) {
+					return o;
+				}
+			}
+			return ReadLoose(oid);
+		}
+		ObjectPtr ReadPacked(Pack &p, std::uint32_t i, std::uint32_t depth) {
+			auto oid = p.tables.sha1 + i * 20ULL;
+			pack::ObjectHeader h;
+			pack::DeltaRef ref;
+			auto offset = p.tables.Offset(i);
+			if (depth >= pack::MaxDeltaDepth || ++entries > MaxEntries || !pack::ReadEntry(p.pk, offset, h, ref)) {
+				return nullptr;
+			}
+			auto o = std::make_shared<Object>();
+			if (!Inflate(p.pk, ref.data, h.size, o->data)) {
+				return nullptr;
+			}
+			o->type = h.type;
+			if (pack::IsDelta(h.type)) {
+				auto b = h.type == pack::OfsDelta ? At(p, ref.base) : p.tables.Find(ref.oid);
+				ObjectPtr base;
+				if (b == UINT32_MAX) {
+					base = h.type == pack::OfsDelta ? nullptr : Read(ref.oid, depth + 1);
+				}
+				else if (!(base = cache.Get(p.tables.sha1 + b * 20ULL))) {
+					base = ReadPacked(p, b, depth + 1);
+				}
+				std::vector<std::uint8_t> result;
+				if (!base || !ApplyDelta(base->data.data(), base->data.size(), o->data.data(), o->data.size(), result)) {
+					return nullptr;
+				}
+				o->type = base->type;
+				o->data.swap(result);
+			}
+			cache.Put(oid, o);
+			return o;
+		}
+		/// idx position of the entry at offset, UINT32_MAX when there is none
+		std::uint32_t At(Pack &p, std::uint64_t offset) {
+			auto n = p.tables.norsize;
+			if (p.revtable == nullptr && p.order.empty()) {
+				p.order.resize(n);
+				for (std::uint32_t i = 0; i < n; i++) {
+					p.order[i].offset = p.tables.Offset(i);
+					p.order[i].index = i;
+				}
+				std::sort(p.order.begin(), p.order.end(), [](const idx::ObjectIndexLarge &a, const idx::ObjectIndexLarge &b) {
+					return a.offset < b.offset;
+				});
+			}
+			std::uint32_t lo = 0, hi = n;
+			while (lo < hi) {
+				auto mid = lo + (hi - lo) / 2;
+				auto i = p.revtable != nullptr ? base::LoadBE32(p.revtable + mid * 4ULL) : p.order[mid].index;
+				if (i >= n) {
+					return UINT32_MAX;
+				}
+				auto off = p.revtable != nullptr ? p.tables.Offset(i) : p.order[mid].offset;
+				if (off == offset) {
+					return i;
+				}
+				if (off < offset) {
+					lo = mid + 1;
+				}
+				else {
+					hi = mid;
+				}
+			}
+			return UINT32_MAX;
+		}
+		/// the zlib stream at pos must hold exactly size bytes
+		static bool Inflate(pack::PackView &pk, std::uint64_t pos, std::uint64_t size, std::vector<std::uint8_t> &out) {
+			const auto end = pk.size() - 20;
+			if (size > end * 1032ULL) {
+				return false; /// deflate tops out near 1032:1, anything above is a corrupt header
+			}
+			out.resize(static_cast<std::size_t>(size));
+			auto next = [&](const std::uint8_t *&p, std::size_t &n) {
+				if (pos >= end) {
+					return false;
+				}
+				p = pk.Fetch(pos, 1 << 16, n);
+				if (p == nullptr) {
+					return false;
+				}
+				n = static_cast<std::size_t>((std::min)(static_cast<std::uint64_t>(n), end - pos));
+				pos += n;
+				return true;
+			};
+			std::uint8_t empty[1];
+			std::size_t produced = 0;
+			return base::Inflater::Local().Peek(next, size == 0 ? empty : out.data(), out.size(), produced) &&
+				produced == size;
+		}
+		ObjectPtr ReadLoose(const std::uint8_t *oid) {
+			wchar_t hex[48];
+			base::Sha1Hex(oid, hex);
+			auto file = objpath / std::wstring(hex, 2) / std::wstring(hex + 2, 38);
+			base::MapView view;
+			if (!view.Open(file.wstring())) {
+				return nullptr;
+			}
+			auto fed = false;
+			auto next = [&](const std::uint8_t *&p, std::size_t &n) {
+				if (fed) {
+					return false;
+				}
+				fed = true;
+				p = view.data();
+				n = static_cast<std::size_t>(view.size());
+				return true;
+			};
+			/// header first, to learn the size
+			std::uint8_t head[loose::MaxHeaderSize];
+			std::size_t produced = 0;
+			pack::ObjectHeader h;
+			if (!base::Inflater::Local().Peek(next, head, sizeof(head), produced) ||
+				!loose::ParseHeader(head, produced, h) || h.size > view.size() * 1032ULL) {
+				return nullptr;
+			}
+			std::vector<std::uint8_t> raw(static_cast<std::size_t>(h.length + h.size));
+			fed = false;
+			if (!base::Inflater::Local().Peek(next, raw.data(), raw.size(), produced) || produced != raw.size()) {
+				return nullptr;
+			}
+			auto o = std::make_shared<Object>();
+			o->type = h.type;
+			o->data.assign(raw.begin() + h.length, raw.end());
+			cache.Put(oid, o);
+			return o;
+		}
+		static constexpr std::uint32_t MaxEntries = 4 * pack::MaxDeltaDepth;
+		std::filesystem::path objpath;
+		std::vector<std::unique_ptr<Pack>> packs;
+		ObjectCache cache;
+		std::uint32_t entries{ 0 }; /// pack entries the current Read decoded
+	};
+}
+
+#endif
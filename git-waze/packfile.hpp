@@ -1,7 +1,12 @@
 #ifndef GIT_WAZE_PACKFILE_HPP
 #define GIT_WAZE_PACKFILE_HPP
+#include <atomic>
 #include "base.hpp"
+#include "checksum.hpp"
 #include "console.hpp"
+#include "idxfile.hpp"
+#include "inflate.hpp"
+#include "uring.hpp"
 
 #pragma once
 namespace pack {
@@ -9,175 +14,673 @@ namespace pack {
 		std::uint32_t magic;
 		std::uint32_t version;
 	};
-	struct FileIndex {
-		std::uint64_t size;
-		std::uint32_t index;
+	enum ObjectType : std::uint8_t {
+		None = 0,
+		Commit = 1,
+		Tree = 2,
+		Blob = 3,
+		Tag = 4,
+		OfsDelta = 6,
+		RefDelta = 7
 	};
+	struct ObjectHeader {
+		std::uint64_t size{ 0 }; /// inflated size, for deltas the delta size
+		std::uint32_t length{ 0 }; /// header bytes
+		std::uint8_t type{ None };
+	};
+	/// 4 + 9 * 7 bits already cover a 64-bit size
+	const constexpr std::size_t MaxHeaderSize = 10;
+
+	/// decode type and size of the object header in [p, end). false when truncated
+	/// or when the size does not fit 64 bits
+	inline bool DecodeHeader(const std::uint8_t *p, const std::uint8_t *end, ObjectHeader &h) {
+		const constexpr uint8_t firstLengthBites = 4;
+		const constexpr uint8_t lengthBits = 7;
+		const constexpr int maskFirstLength = 15;
+		const constexpr int maskContinue = 0x80;
+		const constexpr uint8_t maskType = 112;
+		const constexpr uint8_t maskLength = 127;
+		if (p >= end) {
+			return false;
+		}
+		auto begin = p;
+		unsigned char b = *p++;
+		// https://github.com/src-d/go-git/blob/master/plumbing/format/packfile/scanner.go#L243
+		h.type = static_cast<std::uint8_t>((b & maskType) >> firstLengthBites);
+		auto length = static_cast<std::uint64_t>(b & maskFirstLength);
+		unsigned shift = firstLengthBites;
+		while ((b & maskContinue) > 0) {
+			if (p >= end || shift > 60) {
+				return false;
+			}
+			b = *p++;
+			length += static_cast<std::uint64_t>(b & maskLength) << shift;
+			shift += lengthBits;
+		}
+		h.size = length;
+		h.length = static_cast<std::uint32_t>(p - begin);
+		return true;
+	}
+
+	/// pack bytes by offset: the mapping when we have one, else a block buffer
+	class PackView {
+	public:
+		bool Open(std::wstring_view file) {
+			if (map.Open(file)) {
+				mapped = true;
+				return true;
+			}
+			mapped = false;
+			return buffered.Open(file);
+		}
+		bool Mapped() const {
+			return mapped;
+		}
+		std::uint64_t size() const {
+			return mapped ? map.size() : buffered.size();
+		}
+		const std::uint8_t *Fetch(std::uint64_t offset, std::size_t n, std::size_t &avail) {
+			if (!mapped) {
+				return buffered.Fetch(offset, n, avail);
+			}
+			if (offset >= map.size()) {
+				avail = 0;
+				return nullptr;
+			}
+			avail = static_cast<std::size_t>((std::min)(static_cast<std::uint64_t>(n), map.size() - offset));
+			return map.data() + offset;
+		}
+	private:
+		base::MapView map;
+		base::BlockReader buffered;
+		bool mapped{ false };
+	};
+
+	inline const wchar_t *TypeName(std::uint8_t type) {
+		switch (type) {
+		case Commit:
+			return L"commit";
+		case Tree:
+			return L"tree";
+		case Blob:
+			return L"blob";
+		case Tag:
+			return L"tag";
+		case OfsDelta:
+			return L"ofs-delta";
+		case RefDelta:
+			return L"ref-delta";
+		default:
+			break;
+		}
+		return L"unknown";
+	}
+	inline bool IsDelta(std::uint8_t type) {
+		return type == OfsDelta || type == RefDelta;
+	}
+	/// git refuses deltas deeper than 4095, anything longer is a broken pack
+	const constexpr std::uint32_t MaxDeltaDepth = 4096;
+
+	/// OFS_DELTA base distance after the object header, a big endian varint
+	/// where every continuation adds one
+	inline bool DecodeOfsDistance(const std::uint8_t *p, const std::uint8_t *end, std::uint64_t &distance,
+		std::uint32_t &length) {
+		auto begin = p;
+		if (p >= end) {
+			return false;
+		}
+		std::uint8_t c = *p++;
+		std::uint64_t v = c & 0x7f;
+		while (c & 0x80) {
+			if (p >= end || v > (UINT64_MAX >> 7) - 1) {
+				return false;
+			}
+			c = *p++;
+			v = ((v + 1) << 7) | (c & 0x7f);
+		}
+		distance = v;
+		length = static_cast<std::uint32_t>(p - begin);
+		return true;
+	}
+
+	/// delta data starts with the base size and the result size, little endian varints
+	inline bool DecodeDeltaSizes(const std::uint8_t *p, const std::uint8_t *end, std::uint64_t &basesize,
+		std::uint64_t &resultsize) {
+		std::uint64_t *sizes[2] = { &basesize, &resultsize };
+		for (auto sz : sizes) {
+			std::uint64_t v = 0;
+			unsigned shift = 0;
+			std::uint8_t c = 0;
+			do {
+				if (p >= end || shift > 63) {
+					return false;
+				}
+				c = *p++;
+				v |= static_cast<std::uint64_t>(c & 0x7f) << shift;
+				shift += 7;
+			} while (c & 0x80);
+			*sz = v;
+		}
+		return true;
+	}
+
+	/// where an entry's zlib stream starts and, for deltas, what it is based on
+	struct DeltaRef {
+		std::uint64_t data{ 0 };
+		std::uint64_t base{ 0 }; /// OFS_DELTA base offset
+		std::uint8_t oid[20]; /// REF_DELTA base
+	};
+
+	/// decode the entry at offset: header, then the base reference of deltas.
+	/// Object data never reaches into the trailing pack checksum
+	inline bool ReadEntry(PackView &pk, std::uint64_t offset, ObjectHeader &h, DeltaRef &ref) {
+		if (pk.size() < 20) {
+			return false;
+		}
+		const auto end = pk.size() - 20;
+		if (offset >= end) {
+			return false;
+		}
+		std::size_t avail = 0;
+		auto p = pk.Fetch(offset, MaxHeaderSize + 20, avail);
+		if (p == nullptr) {
+			return false;
+		}
+		avail = static_cast<std::size_t>((std::min)(static_cast<std::uint64_t>(avail), end - offset));
+		if (!DecodeHeader(p, p + avail, h)) {
+			return false;
+		}
+		ref.data = offset + h.length;
+		if (h.type == OfsDelta) {
+			std::uint64_t distance = 0;
+			std::uint32_t length = 0;
+			if (!DecodeOfsDistance(p + h.length, p + avail, distance, length) || distance == 0 || distance > offset) {
+				return false;
+			}
+			ref.base = offset - distance;
+			ref.data += length;
+		}
+		else if (h.type == RefDelta) {
+			if (avail < h.length + 20ULL) {
+				return false;
+			}
+			memcpy(ref.oid, p + h.length, 20);
+			ref.data += 20;
+		}
+		return true;
+	}
+
+	inline bool ObjectSize(PackView &pk, std::uint64_t offset, ObjectHeader &h) {
+		DeltaRef ref;
+		return ReadEntry(pk, offset, h, ref);
+	}
+
+	/// size of the object an entry stands for. Whole objects carry it in the
+	/// header, a delta carries its result size in the first bytes of its data,
+	/// so only those few bytes are inflated and no base is ever read
+	inline bool ResolvedSize(PackView &pk, const ObjectHeader &h, const DeltaRef &ref, std::uint64_t &size) {
+		if (!IsDelta(h.type)) {
+			size = h.size;
+			return true;
+		}
+		const auto end = pk.size() - 20;
+		auto pos = ref.data;
+		auto next = [&](const std::uint8_t *&p, std::size_t &n) {
+			if (pos >= end) {
+				return false;
+			}
+			p = pk.Fetch(pos, 64, n);
+			if (p == nullptr) {
+				return false;
+			}
+			n = static_cast<std::size_t>((std::min)(static_cast<std::uint64_t>(n), end - pos));
+			pos += n;
+			return true;
+		};
+		std::uint8_t out[20];
+		std::size_t produced = 0;
+		std::uint64_t basesize = 0;
+		if (!base::Inflater::Local().Peek(next, out, sizeof(out), produced)) {
+			return false;
+		}
+		return DecodeDeltaSizes(out, out + produced, basesize, size);
+	}
+
+	/// end of a delta chain: the object type and how many deltas sit on the
+	/// whole object, 0 for whole objects. type None when the walk failed
+	struct Resolved {
+		std::uint8_t type{ None };
+		std::uint32_t depth{ 0 };
+	};
+
+	/// a Resolved in two bytes, what analyzers keep per entry: type in the low
+	/// 3 bits, chain depth above, 0 while unknown
+	typedef std::uint16_t Memo;
+	inline Memo SaveMemo(const Resolved &r) {
+		return static_cast<Memo>(r.type | (std::min)(r.depth, 0x1fffU) << 3);
+	}
+	inline Resolved LoadMemo(Memo m) {
+		return Resolved{ static_cast<std::uint8_t>(m & 7), static_cast<std::uint32_t>(m >> 3) };
+	}
+
+	/// walk a delta chain to its whole object. lookup(oid, offset) resolves
+	/// REF_DELTA bases, memo(offset) may short cut the walk with a known
+	/// Resolved and visit(offset, resolved) hears about every entry passed
+	template <typename LookupFn, typename MemoFn, typename VisitFn>
+	Resolved ResolveType(PackView &pk, std::uint64_t offset, ObjectHeader h, DeltaRef ref,
+		const LookupFn &lookup, const MemoFn &memo, const VisitFn &visit) {
+		std::uint64_t chain[64]; /// chain[i] is i hops below the first entry
+		std::uint32_t n = 0;
+		Resolved r;
+		for (std::uint32_t step = 0; step < MaxDeltaDepth; step++) {
+			if (!IsDelta(h.type)) {
+				r.type = h.type;
+				r.depth = step;
+				if (step > 0 && n < 64) {
+					chain[n++] = offset;
+				}
+				break;
+			}
+			if (n < 64) {
+				chain[n++] = offset;
+			}
+			std::uint64_t base = ref.base;
+			if (h.type == RefDelta && !lookup(ref.oid, base)) {
+				break;
+			}
+			auto m = memo(base);
+			if (m.type != None) {
+				r.type = m.type;
+				r.depth = m.depth + step + 1;
+				break;
+			}
+			offset = base;
+			if (!ReadEntry(pk, offset, h, ref)) {
+				break;
+			}
+		}
+		if (r.type != None) {
+			for (std::uint32_t i = 0; i < n; i++) {
+				visit(chain[i], Resolved{ r.type, r.depth - i });
+			}
+		}
+		return r;
+	}
+
 	class PackAnalyzer {
 	public:
+		enum : std::uint32_t {
+			Lookahead = 1024, /// objects in pack order the prefetch runs ahead of review
+			/// mean entry size from which headers sit pages apart. Denser packs
+			/// are streamed by the kernel's readahead, prefetching only costs there
+			SparseEntry = 64 * 1024,
+			HashChunk = 1 << 20 /// bytes per checksum update, --verify polls the budget in between
+		};
 		PackAnalyzer(base::Wfs&wfs_) :wfs(wfs_) {}
 		~PackAnalyzer() {
-			if (hIdx != INVALID_HANDLE_VALUE) {
-				CloseHandle(hIdx);
-			}
-			if (hPk != INVALID_HANDLE_VALUE) {
-				CloseHandle(hPk);
-			}
+			base::CloseFile(ahead);
 		}
+		PackAnalyzer(const PackAnalyzer &) = delete;
+		PackAnalyzer &operator=(const PackAnalyzer &) = delete;
 		const auto &LastError()const {
 			return lasterror;
 		}
 		bool resolve(std::wstring_view file) {
-			hPk = CreateFileW(file.data(),
-				GENERIC_READ,
-				FILE_SHARE_READ,
-				nullptr,
-				OPEN_EXISTING,
-				FILE_ATTRIBUTE_NORMAL,
-				nullptr);
-			if (hPk == INVALID_HANDLE_VALUE) {
+			stats::Timer timer(stats::Verify);
+			if (!pk.Open(file)) {
 				lasterror.assign(L"open packfile: ").append(base::SystemError());
 				return false;
 			}
+			/// 'PACK' version(2|3) objects ... sha1
+			std::size_t avail = 0;
+			auto pkh = pk.Fetch(0, 4 * 3, avail);
+			if (pkh == nullptr || avail < 4 * 3 || pk.size() < 4 * 3 + 20 || base::LoadBE32(pkh) != 0x5041434b) {
+				lasterror.assign(L"invalid packfile: ").append(file);
+				return false;
+			}
+			auto pkobjects = base::LoadBE32(pkh + 8);
 			auto idf = std::wstring(file.substr(0, file.size() - sizeof("pack") + 1)).append(L"idx"); /// replace subffix
-			hIdx = CreateFileW(idf.data(),
-				GENERIC_READ,
-				FILE_SHARE_READ,
-				nullptr,
-				OPEN_EXISTING,
-				FILE_ATTRIBUTE_NORMAL,
-				nullptr);
-			if (hIdx == INVALID_HANDLE_VALUE) {
+			if (!idx.Open(idf)) {
 				lasterror.assign(L"open idxfile: ").append(base::SystemError());
 				return false;
 			}
-			if (!GetFileSizeEx(hIdx, &idxsize)) {
-				lasterror.assign(L"get idxfile size: ").append(base::SystemError());
+			if (!idx::ParseIndex(idx, tables)) {
+				lasterror.assign(L"invalid idxfile: ").append(idf);
 				return false;
 			}
-			IndexHeader idh;
-			if (!base::Readimpl(hIdx, &idh)) {
+			if (pkobjects != tables.norsize) {
+				lasterror.assign(L"pack and idx object counts mismatch: ").append(file);
 				return false;
 			}
-			/// we known Windows ARM is LE
-			/// https://blogs.msdn.microsoft.com/larryosterman/2005/06/07/the-endian-of-windows/
-			/// https://msdn.microsoft.com/en-us/library/dn736986.aspx
-			/// iOS is LE
-			if (idh.version != bswap32(2)) {
-				return false;
+			norsize = tables.norsize;
+			lasize = tables.lasize;
+			auto ridf = std::wstring(file.substr(0, file.size() - sizeof("pack") + 1)).append(L"rev");
+			if (rev.Open(ridf)) {
+				revtable = idx::ParseReverseIndex(rev, norsize);
+			}
+			if (wfs.prefetch && norsize != 0 && pk.size() / norsize >= SparseEntry && base::Uring::Local().Ready()) {
+				ahead = base::Openreadonly(file);
 			}
-			if (!base::FileSeek(hIdx, (std::uint64_t)(4 * 255), FILE_BEGIN)) {
+			return true;
+		}
+		/// can ranges of this pack be reviewed from several threads at once
+		bool Splittable() const {
+			return pk.Mapped();
+		}
+		std::uint32_t ObjectCount() const {
+			return norsize;
+		}
+		/// build the offset-ordered object list, ranges below index into it. With
+		/// a .rev the ranges index the reverse index and no list is built. Either
+		/// way two bytes per object memoize the type and depth delta chains resolve to.
+		/// Both come from the arena when given one, the caller keeps it alive
+		/// and on this thread for as long as the analyzer is used
+		bool prepare(base::Arena *arena = nullptr) {
+			stats::Timer timer(stats::Sort);
+			auto footprint = norsize * (sizeof(Memo) + (revtable != nullptr ? 0 : sizeof(idx::ObjectIndexLarge)));
+			if (footprint > wfs.memlimit) {
+				lasterror.assign(L"object counts more than memory limit: ").append(std::to_wstring(norsize));
 				return false;
 			}
-			std::uint32_t nr;
-			if (!base::Readimpl(hIdx, &nr)) {
+			if (!types.Allocate(norsize, arena) ||
+				(revtable == nullptr && !objs.Allocate(norsize, arena))) {
+				lasterror.assign(L"object counts more than memory limit: ").append(std::to_wstring(norsize));
 				return false;
 			}
-			norsize = bswap32(nr);
-			lasize = static_cast<std::uint32_t>((idxsize.QuadPart - norsize * (20 + 4 + 4) - 4 * 2 - 4 * 256 - 2 * 20) / 8);
+			for (std::uint32_t k = 0; k < norsize; k++) {
+				types[k].store(0, std::memory_order_relaxed);
+			}
+			if (revtable != nullptr) {
+				return true;
+			}
+			/// visit objects in pack order so header reads walk the pack forward
+			for (std::uint32_t i = 0; i < norsize; i++) {
+				auto off = base::LoadBE32(tables.offsets + i * 4ULL);
+				if (!(off & 0x80000000)) {
+					objs[i].offset = off;
+				}
+				else {
+					off = off & 0x7fffffff;
+					if (off >= lasize) {
+						lasterror.assign(L"large offset out of range: ").append(std::to_wstring(off));
+						return false;
+					}
+					objs[i].offset = base::LoadBE64(tables.largeoffsets + off * 8ULL);
+				}
+				objs[i].index = i;
+			}
+			std::sort(objs.data(), objs.data() + norsize, [](const idx::ObjectIndexLarge &a, const idx::ObjectIndexLarge &b) {
+				return a.offset < b.offset;
+			});
 			return true;
 		}
-		bool review(std::uint64_t limitsize, std::uint64_t warnsize) {
-			std::vector<std::uint64_t> lnrv;
-			if (lasize > 0) {
-				if (lasize * sizeof(std::uint64_t) > wfs.memlimit) {
-					lasterror.assign(L"Large number counts more than memory limit: %ld", wfs.memlimit);
+		bool review(std::uint64_t limitsize, std::uint64_t warnsize, base::Arena *arena = nullptr) {
+			if (!prepare(arena)) {
+				return false;
+			}
+			return review(0, norsize, limitsize, warnsize, wfs, lasterror);
+		}
+		/// review objects [first, last) in pack order into out. Safe to call
+		/// concurrently on disjoint ranges when Splittable(). Limits apply to the
+		/// resolved object size, on-disk and inflated sizes are kept for the report
+		bool review(std::uint32_t first, std::uint32_t last, std::uint64_t limitsize, std::uint64_t warnsize,
+			base::Wfs &out, std::wstring &err) {
+			stats::Timer timer(stats::PackRead);
+			const auto end = pk.size() - 20;
+			idx::ObjectIndexLarge o;
+			if (first < last && !At(first, o, err)) {
+				return false;
+			}
+			auto queued = first;
+			std::uint64_t lastpage = UINT64_MAX;
+			for (auto k = first; k < last; k++) {
+				if (out.Interrupted(k - first)) {
+					err.clear();
 					return false;
 				}
-				lnrv.resize(lasize);
-				if (!base::FileSeek(hIdx, 4 + 4 + 256 * 4 + norsize * (20 + 4 + 4), FILE_BEGIN)) {
+				if (ahead != base::InvalidFile && (k & 15) == 0) {
+					queued = Prefetch(k, queued, last, lastpage);
+				}
+				/// an entry ends where the next one in pack order starts
+				idx::ObjectIndexLarge nx;
+				if (k + 1 < norsize && !At(k + 1, nx, err)) {
 					return false;
 				}
-				if (!base::Readimpl(hIdx, lnrv.data(), lasize)) {
+				auto next = k + 1 < norsize ? nx.offset : end;
+				ObjectHeader h;
+				DeltaRef ref;
+				std::uint64_t sz = 0;
+				if (next <= o.offset || next > end || !ReadEntry(pk, o.offset, h, ref) || !ResolvedSize(pk, h, ref, sz)) {
+					err.assign(L"bad object at offset ").append(std::to_wstring(o.offset));
 					return false;
 				}
+				auto rs = Type(k, o.offset, h, ref);
+				out.stats.Add(h.type, h.size, next - o.offset);
+				if (IsDelta(h.type) && rs.type != None) {
+					out.stats.AddDepth(rs.depth);
+				}
+				if (sz > warnsize) {
+					base::LargeObject lo;
+					lo.size = sz;
+					lo.disk = next - o.offset;
+					lo.inflated = h.size;
+					lo.type = rs.type;
+					memcpy(lo.oid, tables.sha1 + o.index * 20ULL, 20);
+					if (sz > limitsize) {
+						wchar_t hex[48];
+						console::Printeln(L"File: %ls size %4.2f MB, more than %4.2f MB",
+							base::Sha1Hex(lo.oid, hex), (float)sz / base::Megabyte,
+							(float)limitsize / base::Megabyte);
+						out.overlimit.push_back(lo);
+						if (out.StopOnLimit()) {
+							return false;
+						}
+					}
+					else {
+						out.files.Push(lo);
+						out.counts++;
+					}
+				}
+				o = nx;
 			}
-			if (!base::FileSeek(hIdx, 4 + 4 + 256 * 4 + norsize * (20 + 4), FILE_BEGIN)) {
+			return true;
+		}
+		/// --verify: the SHA-1 trailing the pack over everything before it, the
+		/// idx and .rev trailers over their files, and the copies of the pack
+		/// checksum both carry. The pack is hashed front to back on this thread,
+		/// SHA-1 does not split
+		bool checksums(base::Wfs &out, std::wstring &err) {
+			stats::Timer timer(stats::Hash);
+			const auto end = pk.size() - 20;
+			base::Sha1 h;
+			for (std::uint64_t pos = 0; pos < end;) {
+				if (out.Interrupted(0)) {
+					err.clear();
+					return false;
+				}
+				std::size_t avail = 0;
+				auto p = pk.Fetch(pos, static_cast<std::size_t>((std::min)(end - pos, std::uint64_t(HashChunk))), avail);
+				if (p == nullptr || avail == 0) {
+					err.assign(L"read packfile at offset ").append(std::to_wstring(pos));
+					return false;
+				}
+				h.Update(p, avail);
+				pos += avail;
+			}
+			std::uint8_t sum[20];
+			h.Final(sum);
+			std::size_t avail = 0;
+			auto trailer = pk.Fetch(end, 20, avail);
+			if (trailer == nullptr || avail < 20 || memcmp(sum, trailer, 20) != 0) {
+				err.assign(L"pack checksum mismatch");
 				return false;
 			}
-			std::vector<FileIndex> windex;
-			windex.reserve(4);
-			for (std::uint32_t i = 0; i < norsize; i++) {
-				std::uint32_t in;
-				std::uint64_t offset{ 0 };
-				if (!base::Readimpl(hIdx, &in)) {
+			auto selfcheck = [&](const base::MapView &view, const wchar_t *what) {
+				if (memcmp(view.data() + view.size() - 40, sum, 20) != 0) {
+					err.assign(what).append(L" names another pack");
 					return false;
 				}
-				auto off = bswap32(in);
-				if (!(off & 0x80000000)) {
-					offset = off;
+				if (!base::TrailerMatches(view)) {
+					err.assign(what).append(L" checksum mismatch");
+					return false;
 				}
-				else {
-					off = off * 0x7fffffff;
-					if (off >= lasize) {
+				return true;
+			};
+			return selfcheck(idx, L"idx") && (revtable == nullptr || selfcheck(rev, L"rev"));
+		}
+		/// --verify: CRC32 of every entry in [first, last) of pack order, header
+		/// and zlib stream as stored, against the idx table. Mismatches are
+		/// printed as they are found and the range goes on. Needs prepare, safe
+		/// on disjoint ranges when Splittable()
+		bool crc(std::uint32_t first, std::uint32_t last, base::Wfs &out, std::wstring &err) {
+			stats::Timer timer(stats::Hash);
+			const auto end = pk.size() - 20;
+			std::uint32_t bad = 0;
+			idx::ObjectIndexLarge o;
+			if (first < last && !At(first, o, err)) {
+				return false;
+			}
+			for (auto k = first; k < last; k++) {
+				if (out.Interrupted(k - first)) {
+					err.clear();
+					return false;
+				}
+				idx::ObjectIndexLarge nx;
+				if (k + 1 < norsize && !At(k + 1, nx, err)) {
+					return false;
+				}
+				auto next = k + 1 < norsize ? nx.offset : end;
+				if (next <= o.offset || next > end) {
+					err.assign(L"bad object at offset ").append(std::to_wstring(o.offset));
+					return false;
+				}
+				std::uint32_t c = 0;
+				for (auto pos = o.offset; pos < next;) {
+					std::size_t avail = 0;
+					auto p = pk.Fetch(pos, static_cast<std::size_t>((std::min)(next - pos, std::uint64_t(HashChunk))), avail);
+					if (p == nullptr || avail == 0) {
+						err.assign(L"read packfile at offset ").append(std::to_wstring(pos));
 						return false;
 					}
-					offset = bswap64(lnrv[off]);
-				}
-				auto sz = ObjectSize(offset);
-				if (sz > limitsize) {
-					console::Printeln(L"File: %s size %4.2f MB, more than %4.2f MB",
-						base::Sha1FromIndex(hIdx, i), (float)sz / base::Megabyte,
-						(float)limitsize / base::Megabyte);
-#if CHECKLIMIT_RETURN
-					return false;
-#endif
+					c = base::Crc32(c, p, avail);
+					pos += avail;
 				}
-				else if (sz > warnsize) {
-					FileIndex fi;
-					fi.index = i;
-					fi.size = sz;
-					windex.push_back(fi);
+				if (c != base::LoadBE32(tables.crc32 + o.index * 4ULL)) {
+					wchar_t hex[48];
+					console::Printeln(L"Object: %ls crc32 mismatch at offset %llu",
+						base::Sha1Hex(tables.sha1 + o.index * 20ULL, hex), static_cast<unsigned long long>(o.offset));
+					bad++;
 				}
+				o = nx;
 			}
-			wfs.counts += windex.size();
-			for (auto &wi : windex) {
-				if (wfs.files.size() >= wfs.limits) {
+			if (bad != 0) {
+				err.assign(std::to_wstring(bad)).append(L" objects with a bad crc32");
+				return false;
+			}
+			return true;
+		}
+	private:
+		/// Queue header reads for the objects after k on this thread's ring, at
+		/// most one per page and Lookahead objects ahead. Returns the position
+		/// to continue from, the ring may have filled up before it got there
+		std::uint32_t Prefetch(std::uint32_t k, std::uint32_t queued, std::uint32_t last, std::uint64_t &lastpage) {
+			auto &ring = base::Uring::Local();
+			auto stop = last - k > Lookahead ? k + Lookahead : last;
+			std::wstring unused;
+			idx::ObjectIndexLarge a;
+			for (queued = (std::max)(queued, k); queued < stop; queued++) {
+				if (!At(queued, a, unused)) {
+					break; /// review reports it when it gets there
+				}
+				auto page = a.offset >> 12;
+				if (page == lastpage && ((a.offset + base::Uring::ReadSize - 1) >> 12) == page) {
+					continue;
+				}
+				if (!ring.Read(ahead, a.offset)) {
 					break;
 				}
-				base::FileInfo fileinfo;
-				fileinfo.file = base::Sha1FromIndex(hIdx, wi.index);
-				fileinfo.size = wi.size;
-				wfs.files.push_back(std::move(fileinfo));
+				stats::Add(stats::Prefetches);
+				lastpage = page;
 			}
+			ring.Submit();
+			return queued;
+		}
+		/// k-th object in pack order
+		bool At(std::uint32_t k, idx::ObjectIndexLarge &o, std::wstring &err) const {
+			if (revtable == nullptr) {
+				o = objs[k];
+				return true;
+			}
+			o.index = base::LoadBE32(revtable + k * 4ULL);
+			if (o.index >= norsize) {
+				err.assign(L"reverse index out of range: ").append(std::to_wstring(o.index));
+				return false;
+			}
+			o.offset = tables.Offset(o.index);
 			return true;
 		}
+		/// pack order position of the entry at offset, norsize when there is none
+		std::uint32_t Position(std::uint64_t offset) const {
+			std::uint32_t lo = 0, hi = norsize;
+			while (lo < hi) {
+				auto mid = lo + (hi - lo) / 2;
+				auto off = revtable != nullptr ? tables.Offset(base::LoadBE32(revtable + mid * 4ULL)) : objs[mid].offset;
+				if (off == offset) {
+					return mid;
+				}
+				if (off < offset) {
+					lo = mid + 1;
+				}
+				else {
+					hi = mid;
+				}
+			}
+			return norsize;
+		}
+		Resolved Type(std::uint32_t k, std::uint64_t offset, const ObjectHeader &h, const DeltaRef &ref) {
+			if (!IsDelta(h.type)) {
+				types[k].store(h.type, std::memory_order_relaxed);
+				return Resolved{ h.type, 0 };
+			}
+			auto t = LoadMemo(types[k].load(std::memory_order_relaxed));
+			if (t.type != None) {
+				return t;
+			}
+			auto lookup = [&](const std::uint8_t *oid, std::uint64_t &base) {
+				auto i = tables.Find(oid);
+				if (i == UINT32_MAX) {
+					return false; /// thin pack, the base lives elsewhere
+				}
+				base = tables.Offset(i);
+				return true;
+			};
+			auto memo = [&](std::uint64_t base) {
+				auto pos = Position(base);
+				return pos < norsize ? LoadMemo(types[pos].load(std::memory_order_relaxed)) : Resolved{};
+			};
+			auto visit = [&](std::uint64_t off, const Resolved &r) {
+				auto pos = Position(off);
+				if (pos < norsize) {
+					types[pos].store(SaveMemo(r), std::memory_order_relaxed);
+				}
+			};
+			t = ResolveType(pk, offset, h, ref, lookup, memo, visit);
+			types[k].store(SaveMemo(t), std::memory_order_relaxed);
+			return t;
+		}
 	private:
-		std::uint64_t ObjectSize(std::uint64_t offset) {
-			const constexpr uint8_t firstLengthBites = 4;
-			const constexpr uint8_t lengthBits = 7;
-			const constexpr int maskFirstLength = 15;
-			const constexpr int maskContinue = 0x80;
-			const constexpr uint8_t maskType = 112;
-			const constexpr uint8_t maskLength = 127;
-			if (!base::FileSeek(hPk, offset, FILE_BEGIN)) {
-				return UINT64_MAX;
-			}
-			unsigned char b;
-			DWORD dwRead = 0;
-			if (ReadFile(hPk, &b, 1, &dwRead, nullptr) != TRUE) {
-				return UINT64_MAX;
-			}
-			// https://github.com/src-d/go-git/blob/master/plumbing/format/packfile/scanner.go#L243
-			auto t = ((b & maskType) >> firstLengthBites); // type
-			auto length = (int64_t)(b & maskFirstLength);
-			auto shift = firstLengthBites;
-			while ((b & maskContinue) > 0) {
-				if (ReadFile(hPk, &b, 1, &dwRead, nullptr) != TRUE) {
-					return UINT64_MAX;
-				}
-				length += (int64_t)(b & maskLength) << shift;
-				shift += lengthBits;
-			}
-			return length;
-		}
-		HANDLE hIdx{ INVALID_HANDLE_VALUE };
-		HANDLE hPk{ INVALID_HANDLE_VALUE };
+		base::MapView idx;
+		base::MapView rev;
+		PackView pk;
+		idx::IndexTables tables;
+		const std::uint8_t *revtable{ nullptr };
+		base::FileHandle ahead{ base::InvalidFile }; /// read by the prefetch ring
+		base::Scratch<idx::ObjectIndexLarge> objs;
+		base::Scratch<std::atomic<Memo>> types;
 		std::wstring lasterror;
 		base::Wfs &wfs;
-		LARGE_INTEGER idxsize;
-		std::uint32_t norsize;
-		std::uint32_t lasize;
+		std::uint32_t norsize{ 0 };
+		std::uint32_t lasize{ 0 };
 	};
 }
 
@@ -0,0 +1,273 @@
+#ifndef GIT_WAZE_REDUNDANCY_HPP
+#define GIT_WAZE_REDUNDANCY_HPP
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "base.hpp"
+#include "idxfile.hpp"
+
+#pragma once
+namespace idx {
+	/// Tournament tree of losers over k sorted sources. The source with the
+	/// smallest head sits at the top, and once it moved on Replay plays its
+	/// new head against the losers on its own leaf's path: log2(k) compares
+	/// and no others. less(a, b) orders sources by their heads, an exhausted
+	/// source orders after every other
+	template <typename LessFn>
+	class LoserTree {
+	public:
+		LoserTree(std::uint32_t k_, const LessFn &less_) :k(k_), less(less_), nodes((std::max)(k_, 1U), 0) {
+			/// winners bottom up, leaf i is node k + i and node n plays 2n against 2n + 1
+			std::vector<std::uint32_t> winners(2 * static_cast<std::size_t>(k) + 1, 0);
+			for (std::uint32_t i = 0; i < k; i++) {
+				winners[k + i] = i;
+			}
+			for (auto n = k - 1; n > 0 && k > 1; n--) {
+				auto l = winners[2 * n];
+				auto r = winners[2 * n + 1];
+				auto rwins = less(r, l);
+				winners[n] = rwins ? r : l;
+				nodes[n] = rwins ? l : r;
+			}
+			nodes[0] = k > 1 ? winners[1] : 0;
+		}
+		std::uint32_t Top() const {
+			return nodes[0];
+		}
+		/// the top source advanced to its next head
+		void Replay() {
+			auto w = nodes[0];
+			for (auto n = (w + k) / 2; n > 0; n /= 2) {
+				if (less(nodes[n], w)) {
+					std::swap(nodes[n], w);
+				}
+			}
+			nodes[0] = w;
+		}
+	private:
+		std::uint32_t k;
+		LessFn less;
+		std::vector<std::uint32_t> nodes; /// nodes[0] the winner, nodes[1, k) the losers
+	};
+
+	/// objects two packs both store
+	struct PackPair {
+		std::uint32_t a{ 0 }; /// pack numbers, a < b
+		std::uint32_t b{ 0 };
+		std::uint64_t objects{ 0 };
+		std::uint64_t bytes{ 0 }; /// the larger copy of each, what repacking the two would drop
+	};
+
+	/// Objects stored in more than one pack of a repository. The sorted oid
+	/// tables of every .idx merge in one pass through a loser tree, so an oid
+	/// is compared against log2(packs) others and never hashed or kept. Only
+	/// duplicated copies are remembered, their on-disk sizes come from one
+	/// more pass over each pack's offsets. The .pack files are never read
+	class RedundancyAnalyzer {
+	public:
+		RedundancyAnalyzer(base::Wfs &wfs_) :wfs(wfs_) {}
+		const auto &LastError()const {
+			return lasterror;
+		}
+		/// each call adds one pack, opening its idx
+		bool resolve(std::wstring_view file) {
+			stats::Timer timer(stats::Verify);
+			auto s = std::make_unique<Source>();
+			auto pkflen = base::Filesize(file);
+			if (pkflen < 20) {
+				lasterror.assign(L"get packfile size: ").append(base::SystemError());
+				return false;
+			}
+			auto idf = std::wstring(file.substr(0, file.size() - sizeof("pack") + 1)).append(L"idx"); /// replace subffix
+			if (!s->idx.Open(idf)) {
+				lasterror.assign(L"open idxfile: ").append(base::SystemError());
+				return false;
+			}
+			if (!ParseIndex(s->idx, s->tables)) {
+				lasterror.assign(L"invalid idxfile: ").append(idf);
+				return false;
+			}
+			s->name.assign(file);
+			s->end = static_cast<std::uint64_t>(pkflen) - 20;
+			sources.push_back(std::move(s));
+			return true;
+		}
+		bool review() {
+			stats::Timer timer(stats::Merge);
+			return merge() && measure();
+		}
+		std::uint32_t PackCount() const {
+			return static_cast<std::uint32_t>(sources.size());
+		}
+		const std::wstring &PackName(std::uint32_t i) const {
+			return sources[i]->name;
+		}
+		/// distinct objects over every pack
+		std::uint64_t Objects() const {
+			return objects;
+		}
+		/// objects in more than one pack
+		std::uint64_t Duplicated() const {
+			return runs.size();
+		}
+		/// copies beyond the first of each duplicated object
+		std::uint64_t ExtraCopies() const {
+			return copies.size() - runs.size();
+		}
+		/// on-disk bytes of every copy beyond the smallest of its object
+		std::uint64_t WastedBytes() const {
+			return wasted;
+		}
+		/// every pair of packs sharing objects, most bytes first
+		std::vector<PackPair> Pairs() const {
+			std::vector<PackPair> v;
+			v.reserve(pairs.size());
+			for (const auto &p : pairs) {
+				v.push_back(p.second);
+			}
+			std::sort(v.begin(), v.end(), [](const PackPair &x, const PackPair &y) {
+				return x.bytes != y.bytes ? x.bytes > y.bytes : (x.a != y.a ? x.a < y.a : x.b < y.b);
+			});
+			return v;
+		}
+	private:
+		struct Source {
+			std::wstring name;
+			base::MapView idx;
+			IndexTables tables;
+			std::uint64_t end{ 0 }; /// where the trailing pack checksum starts
+		};
+		/// one stored copy of a duplicated object
+		struct Copy {
+			std::uint64_t offset;
+			std::uint64_t size;
+			std::uint32_t pack;
+			std::uint32_t index; /// idx position in its pack
+		};
+		/// k-way merge of the oid tables. Equal oids leave the tree back to
+		/// back, a run of two or more is one duplicated object
+		bool merge() {
+			auto k = static_cast<std::uint32_t>(sources.size());
+			std::vector<std::uint32_t> pos(k, 0);
+			auto less = [&](std::uint32_t a, std::uint32_t b) {
+				const auto &x = sources[a]->tables;
+				const auto &y = sources[b]->tables;
+				if (pos[b] >= y.norsize) {
+					return pos[a] < x.norsize;
+				}
+				if (pos[a] >= x.norsize) {
+					return false;
+				}
+				return CompareOid(x.sha1 + pos[a] * 20ULL, y.sha1 + pos[b] * 20ULL) < 0;
+			};
+			LoserTree<decltype(less)> tree(k, less);
+			const std::uint8_t *last = nullptr;
+			Copy first{ 0, 0, 0, 0 };
+			auto inrun = false;
+			for (std::uint64_t n = 0; k > 0; n++) {
+				auto s = tree.Top();
+				const auto &t = sources[s]->tables;
+				if (pos[s] >= t.norsize) {
+					break; /// the smallest head is past its end, so is every other
+				}
+				if (wfs.Interrupted(n)) {
+					lasterror.clear();
+					return false;
+				}
+				auto oid = t.sha1 + pos[s] * 20ULL;
+				Copy c{ t.Offset(pos[s]), 0, s, pos[s] };
+				if (last != nullptr && CompareOid(oid, last) == 0) {
+					if (!inrun) {
+						runs.push_back(copies.size());
+						copies.push_back(first);
+						inrun = true;
+					}
+					copies.push_back(c);
+					if (copies.size() * sizeof(Copy) > wfs.memlimit) {
+						lasterror.assign(L"duplicated objects more than memory limit: ").append(std::to_wstring(runs.size()));
+						return false;
+					}
+				}
+				else {
+					objects++;
+					first = c;
+					last = oid;
+					inrun = false;
+				}
+				pos[s]++;
+				tree.Replay();
+			}
+			return true;
+		}
+		/// an entry ends where the next one in pack order starts. Copies are
+		/// sorted by offset per pack, then every offset of the pack closes
+		/// the copy right before it, so no pack order is ever built
+		bool measure() {
+			std::vector<std::size_t> order(copies.size());
+			for (std::size_t i = 0; i < order.size(); i++) {
+				order[i] = i;
+			}
+			std::sort(order.begin(), order.end(), [&](std::size_t x, std::size_t y) {
+				const auto &a = copies[x];
+				const auto &b = copies[y];
+				return a.pack != b.pack ? a.pack < b.pack : a.offset < b.offset;
+			});
+			std::vector<std::uint64_t> offsets;
+			for (std::size_t lo = 0, hi = 0; lo < order.size(); lo = hi) {
+				auto p = copies[order[lo]].pack;
+				const auto &src = *sources[p];
+				offsets.clear();
+				for (hi = lo; hi < order.size() && copies[order[hi]].pack == p; hi++) {
+					auto &c = copies[order[hi]];
+					if (c.offset >= src.end) {
+						lasterror.assign(L"large offset out of range: ").append(src.name);
+						return false;
+					}
+					c.size = src.end - c.offset;
+					offsets.push_back(c.offset);
+				}
+				for (std::uint32_t i = 0; i < src.tables.norsize; i++) {
+					auto off = src.tables.Offset(i);
+					auto it = std::lower_bound(offsets.begin(), offsets.end(), off);
+					if (it == offsets.begin()) {
+						continue;
+					}
+					auto &c = copies[order[lo + static_cast<std::size_t>(it - offsets.begin()) - 1]];
+					c.size = (std::min)(c.size, off - c.offset);
+				}
+			}
+			for (std::size_t r = 0; r < runs.size(); r++) {
+				auto lo = runs[r];
+				auto hi = r + 1 < runs.size() ? runs[r + 1] : copies.size();
+				std::uint64_t sum = 0;
+				auto smallest = UINT64_MAX;
+				for (auto i = lo; i < hi; i++) {
+					sum += copies[i].size;
+					smallest = (std::min)(smallest, copies[i].size);
+					for (auto j = i + 1; j < hi; j++) {
+						auto a = (std::min)(copies[i].pack, copies[j].pack);
+						auto b = (std::max)(copies[i].pack, copies[j].pack);
+						auto &pp = pairs[static_cast<std::uint64_t>(a) << 32 | b];
+						pp.a = a;
+						pp.b = b;
+						pp.objects++;
+						pp.bytes += (std::max)(copies[i].size, copies[j].size);
+					}
+				}
+				wasted += sum - smallest;
+			}
+			return true;
+		}
+		std::wstring lasterror;
+		base::Wfs &wfs;
+		std::vector<std::unique_ptr<Source>> sources;
+		std::vector<Copy> copies; /// every copy of duplicated objects, grouped by object
+		std::vector<std::size_t> runs; /// where each object's copies start
+		std::unordered_map<std::uint64_t, PackPair> pairs;
+		std::uint64_t objects{ 0 };
+		std::uint64_t wasted{ 0 };
+	};
+}
+
+#endif
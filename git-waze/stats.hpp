@@ -0,0 +1,216 @@
+#ifndef GIT_WAZE_STATS_HPP
+#define GIT_WAZE_STATS_HPP
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+/// Scan phase timers and I/O counters for --stats and --trace. Always
+/// compiled in: while off, a timer or counter costs one relaxed load and a
+/// branch. Each thread writes its own slot without locking, slots outlive
+/// their thread and are summed once the workers are gone
+namespace stats {
+	enum Phase : std::uint8_t {
+		Scan, /// one repository or stream, end to end
+		Walk, /// pack directory listing, midx and scan cache lookups
+		Verify, /// .idx, .rev and .midx table parsing
+		Sort, /// offset decoding and sorting into pack order
+		Review, /// idx engine, objects sized by their offsets
+		PackRead, /// pack engine, object headers and delta chains
+		Loose,
+		Stream,
+		Paths,
+		Report,
+		Hash, /// --verify trailer SHA-1s and object CRC32s
+		Merge, /// --redundancy merge of every idx oid table
+		Phases
+	};
+	enum Counter : std::uint8_t {
+		Opens,
+		Maps,
+		MappedBytes,
+		Reads, /// read and pread calls
+		ReadBytes,
+		ScanCacheHits,
+		ScanCacheMisses,
+		ObjectCacheHits, /// --paths decoded object cache
+		ObjectCacheMisses,
+		Prefetches, /// header reads queued on io_uring
+		Counters
+	};
+	inline const char *PhaseName(Phase p) {
+		static const char *names[Phases] = {
+			"scan", "walk", "verify", "sort", "review", "pack_read", "loose", "stream", "paths", "report", "hash", "merge"
+		};
+		return p < Phases ? names[p] : "unknown";
+	}
+	inline const char *CounterName(Counter c) {
+		static const char *names[Counters] = {
+			"opens", "maps", "mapped_bytes", "reads", "read_bytes", "scan_cache_hits", "scan_cache_misses",
+			"object_cache_hits", "object_cache_misses", "prefetches"
+		};
+		return c < Counters ? names[c] : "unknown";
+	}
+
+	typedef std::chrono::steady_clock Clock;
+
+	/// one finished timer, kept for --trace
+	struct Event {
+		std::uint64_t start; /// ns since Enable
+		std::uint64_t duration;
+		Phase phase;
+	};
+
+	struct Slot {
+		enum : std::size_t {
+			MaxEvents = 1 << 20 /// 24 MB a thread, later events only count
+		};
+		std::uint64_t ns[Phases] = { 0 };
+		std::uint64_t calls[Phases] = { 0 };
+		std::uint64_t counters[Counters] = { 0 };
+		std::vector<Event> events;
+		std::uint64_t dropped{ 0 };
+		std::uint32_t tid{ 0 };
+	};
+
+	/// every slot handed out, in the order threads first touched one
+	class Registry {
+	public:
+		enum Level : std::uint8_t {
+			Off,
+			Totals, /// --stats
+			Events /// --trace, every timer kept
+		};
+		static Registry &Get() {
+			static Registry r;
+			return r;
+		}
+		static bool Enabled() {
+			return level.load(std::memory_order_relaxed) != Off;
+		}
+		static bool Tracing() {
+			return level.load(std::memory_order_relaxed) == Events;
+		}
+		/// before any worker starts
+		void Enable(bool trace) {
+			epoch = Clock::now();
+			level.store(trace ? Events : Totals, std::memory_order_relaxed);
+		}
+		Slot &Local() {
+			static thread_local Slot *slot = nullptr;
+			if (slot == nullptr) {
+				std::lock_guard<std::mutex> lock(mu);
+				slots.emplace_back(new Slot);
+				slot = slots.back().get();
+				slot->tid = static_cast<std::uint32_t>(slots.size());
+			}
+			return *slot;
+		}
+		std::uint64_t Since(Clock::time_point t) const {
+			return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(t - epoch).count());
+		}
+		/// every thread's numbers added up, call once the workers are joined
+		Slot Total() {
+			std::lock_guard<std::mutex> lock(mu);
+			Slot t;
+			for (const auto &s : slots) {
+				for (int p = 0; p < Phases; p++) {
+					t.ns[p] += s->ns[p];
+					t.calls[p] += s->calls[p];
+				}
+				for (int c = 0; c < Counters; c++) {
+					t.counters[c] += s->counters[c];
+				}
+				t.dropped += s->dropped;
+			}
+			return t;
+		}
+		/// Chrome trace event JSON, opens in chrome://tracing and Perfetto. One
+		/// complete ("X") event per timer, threads by slot
+		bool WriteTrace(std::wstring_view file) {
+			std::lock_guard<std::mutex> lock(mu);
+			std::ofstream out(std::filesystem::path(file), std::ios::binary | std::ios::trunc);
+			out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+			auto first = true;
+			char line[160];
+			for (const auto &s : slots) {
+				for (const auto &e : s->events) {
+					/// microseconds with the nanoseconds kept as decimals
+					snprintf(line, sizeof(line),
+						"%s\n{\"name\":\"%s\",\"cat\":\"scan\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%llu.%03u,\"dur\":%llu.%03u}",
+						first ? "" : ",", PhaseName(e.phase), s->tid,
+						static_cast<unsigned long long>(e.start / 1000), static_cast<unsigned>(e.start % 1000),
+						static_cast<unsigned long long>(e.duration / 1000), static_cast<unsigned>(e.duration % 1000));
+					out << line;
+					first = false;
+				}
+			}
+			out << "\n]}\n";
+			out.flush();
+			return out.good();
+		}
+	private:
+		Registry() = default;
+		static inline std::atomic<std::uint8_t> level{ Off };
+		Clock::time_point epoch{ Clock::now() };
+		std::mutex mu;
+		std::vector<std::unique_ptr<Slot>> slots;
+	};
+
+	inline void Add(Counter c, std::uint64_t v = 1) {
+		if (!Registry::Enabled()) {
+			return;
+		}
+		Registry::Get().Local().counters[c] += v;
+	}
+
+	/// Time spent in a scope, added to its phase. Phases nest, so totals are
+	/// inclusive: a scan's time holds its sorts and reviews
+	class Timer {
+	public:
+		explicit Timer(Phase phase_) :phase(phase_) {
+			if (Registry::Enabled()) {
+				running = true;
+				start = Clock::now();
+			}
+		}
+		~Timer() {
+			Stop();
+		}
+		Timer(const Timer &) = delete;
+		Timer &operator=(const Timer &) = delete;
+		void Stop() {
+			if (!running) {
+				return;
+			}
+			running = false;
+			auto end = Clock::now();
+			auto &r = Registry::Get();
+			auto &s = r.Local();
+			auto ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+			s.ns[phase] += ns;
+			s.calls[phase]++;
+			if (!Registry::Tracing()) {
+				return;
+			}
+			if (s.events.size() >= Slot::MaxEvents) {
+				s.dropped++;
+				return;
+			}
+			s.events.push_back(Event{ r.Since(start), ns, phase });
+		}
+	private:
+		Clock::time_point start;
+		Phase phase;
+		bool running{ false };
+	};
+}
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef GIT_WAZE_STREAMFILE_HPP
+#define GIT_WAZE_STREAMFILE_HPP
+#include <cstring>
+#include <vector>
+#include "base.hpp"
+#include "console.hpp"
+#include "inflate.hpp"
+#include "packfile.hpp"
+
+#pragma once
+namespace pack {
+	/// Reads a pack front to back from a file or a pipe without its .idx:
+	/// 'git pack-objects --stdout' output or a push before index-pack ran.
+	/// Memory is one input buffer and one inflate window whatever the pack
+	/// size. Oids are unknown without hashing every object, so results carry
+	/// the pack offset, and deltas keep their delta type since bases are gone
+	/// by the time a delta arrives.
+	class StreamAnalyzer {
+	public:
+		enum {
+			InputBuffer = 1 << 20,
+			InflateWindow = 1 << 16
+		};
+		StreamAnalyzer(base::Wfs &wfs_) :wfs(wfs_), buf(InputBuffer), window(InflateWindow) {}
+		~StreamAnalyzer() = default;
+		const auto &LastError()const {
+			return lasterror;
+		}
+		/// 'PACK' version(2|3) objects
+		bool resolve(base::FileHandle fd_) {
+			fd = fd_;
+			if (!Fill(12) || base::LoadBE32(buf.data()) != 0x5041434b) {
+				lasterror.assign(L"invalid pack stream");
+				return false;
+			}
+			auto version = base::LoadBE32(buf.data() + 4);
+			if (version != 2 && version != 3) {
+				lasterror.assign(L"unsupported pack version: ").append(std::to_wstring(version));
+				return false;
+			}
+			norsize = base::LoadBE32(buf.data() + 8);
+			pos = 12;
+			return true;
+		}
+		std::uint32_t ObjectCount() const {
+			return norsize;
+		}
+		/// pack checksum, valid once review went through every entry
+		const std::uint8_t *Checksum() const {
+			return checksum;
+		}
+		/// one pass over every entry: the header and base reference are decoded
+		/// from the buffer, the zlib stream is inflated into a window nobody
+		/// reads except for the delta sizes at its start
+		bool review(std::uint64_t limitsize, std::uint64_t warnsize) {
+			stats::Timer timer(stats::Stream);
+			for (std::uint32_t k = 0; k < norsize; k++) {
+				if (wfs.Interrupted(k)) {
+					lasterror.clear();
+					return false;
+				}
+				auto offset = Offset();
+				Fill(MaxHeaderSize + 20);
+				auto p = buf.data() + pos;
+				auto e = buf.data() + end;
+				ObjectHeader h;
+				if (!DecodeHeader(p, e, h)) {
+					lasterror.assign(L"bad object at offset ").append(std::to_wstring(offset));
+					return false;
+				}
+				auto length = h.length;
+				if (h.type == OfsDelta) {
+					std::uint64_t distance = 0;
+					std::uint32_t n = 0;
+					if (!DecodeOfsDistance(p + length, e, distance, n) || distance == 0 || distance > offset) {
+						lasterror.assign(L"bad delta base at offset ").append(std::to_wstring(offset));
+						return false;
+					}
+					length += n;
+				}
+				else if (h.type == RefDelta) {
+					if (e - p < length + 20LL) {
+						lasterror.assign(L"bad delta base at offset ").append(std::to_wstring(offset));
+						return false;
+					}
+					length += 20;
+				}
+				else if (h.type == None || h.type == 5 || h.type > RefDelta) {
+					lasterror.assign(L"bad object type at offset ").append(std::to_wstring(offset));
+					return false;
+				}
+				pos += length;
+				std::uint8_t head[20];
+				std::size_t headlen = 0;
+				std::uint64_t inflated = 0;
+				auto sink = [&](const std::uint8_t *q, std::size_t n) {
+					if (headlen < sizeof(head)) {
+						auto take = (std::min)(n, sizeof(head) - headlen);
+						memcpy(head + headlen, q, take);
+						headlen += take;
+					}
+					inflated += n;
+				};
+				auto next = [&](const std::uint8_t *&q, std::size_t &n) {
+					if (pos == end && !Fill(1)) {
+						return false;
+					}
+					q = buf.data() + pos;
+					n = end - pos;
+					pos = end;
+					return true;
+				};
+				std::size_t unused = 0;
+				if (!base::Inflater::Local().Drain(next, sink, window.data(), window.size(), unused) ||
+					inflated != h.size) {
+					lasterror.assign(L"bad object data at offset ").append(std::to_wstring(offset));
+					return false;
+				}
+				pos -= unused;
+				wfs.stats.Add(h.type, h.size, Offset() - offset);
+				std::uint64_t sz = h.size;
+				std::uint64_t basesize = 0;
+				if (IsDelta(h.type) && !DecodeDeltaSizes(head, head + headlen, basesize, sz)) {
+					lasterror.assign(L"bad delta at offset ").append(std::to_wstring(offset));
+					return false;
+				}
+				if (sz <= warnsize) {
+					continue;
+				}
+				base::LargeObject lo;
+				memset(lo.oid, 0, sizeof(lo.oid));
+				lo.size = sz;
+				lo.disk = Offset() - offset;
+				lo.inflated = h.size;
+				lo.offset = offset;
+				lo.type = h.type;
+				if (sz > limitsize) {
+					console::Printeln(L"Object: at offset %llu size %4.2f MB, more than %4.2f MB",
+						static_cast<unsigned long long>(offset), (float)sz / base::Megabyte,
+						(float)limitsize / base::Megabyte);
+					wfs.overlimit.push_back(lo);
+					if (wfs.StopOnLimit()) {
+						return false;
+					}
+				}
+				else {
+					wfs.files.Push(lo);
+					wfs.counts++;
+				}
+			}
+			if (!Fill(20)) {
+				lasterror.assign(L"pack stream truncated before its checksum");
+				return false;
+			}
+			memcpy(checksum, buf.data() + pos, 20);
+			pos += 20;
+			return true;
+		}
+	private:
+		/// stream offset of the next unread byte
+		std::uint64_t Offset() const {
+			return consumed + pos;
+		}
+		/// buffer at least n unread bytes, false when the input ends first. The
+		/// unread tail moves to the front before every read
+		bool Fill(std::size_t n) {
+			while (end - pos < n) {
+				if (eof) {
+					return false;
+				}
+				if (pos > 0) {
+					memmove(buf.data(), buf.data() + pos, end - pos);
+					consumed += pos;
+					end -= pos;
+					pos = 0;
+				}
+				auto r = base::ReadSome(fd, buf.data() + end, buf.size() - end);
+				if (r < 0) {
+					lasterror.assign(L"read pack stream: ").append(base::SystemError());
+					eof = true;
+					return false;
+				}
+				if (r == 0) {
+					eof = true;
+					return false;
+				}
+				end += static_cast<std::size_t>(r);
+			}
+			return true;
+		}
+		std::wstring lasterror;
+		base::Wfs &wfs;
+		base::FileHandle fd{ base::InvalidFile };
+		std::vector<std::uint8_t> buf;
+		std::vector<std::uint8_t> window;
+		std::size_t pos{ 0 };
+		std::size_t end{ 0 };
+		std::uint64_t consumed{ 0 };
+		bool eof{ false };
+		std::uint32_t norsize{ 0 };
+		std::uint8_t checksum[20] = { 0 };
+	};
+}
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef GIT_WAZE_TREEWALK_HPP
+#define GIT_WAZE_TREEWALK_HPP
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "base.hpp"
+#include "hexencode.hpp"
+#include "objectstore.hpp"
+
+#pragma once
+namespace odb {
+	/// 40 hex digits at the start of s
+	inline bool ParseOid(std::string_view s, OidKey &oid) {
+		return s.size() >= 40 && base::HexDecode(s.data(), 20, oid.b);
+	}
+
+	/// Every ref tip of a repository: HEAD, loose refs under refs/ and
+	/// packed-refs with their peeled values. Symbolic refs are skipped, their
+	/// target is a ref of its own
+	inline void ReadRefs(const std::filesystem::path &gitdir, std::vector<OidKey> &tips) {
+		OidKey oid;
+		auto addfile = [&](const std::filesystem::path &file) {
+			std::ifstream in(file, std::ios::binary);
+			std::string line;
+			if (std::getline(in, line) && ParseOid(line, oid)) {
+				tips.push_back(oid);
+			}
+		};
+		addfile(gitdir / L"HEAD");
+		std::error_code ec;
+		for (std::filesystem::recursive_directory_iterator it(gitdir / L"refs", ec), end; !ec && it != end;
+			it.increment(ec)) {
+			if (it->is_regular_file(ec)) {
+				addfile(it->path());
+			}
+		}
+		std::ifstream in(gitdir / L"packed-refs", std::ios::binary);
+		std::string line;
+		while (std::getline(in, line)) {
+			std::string_view s(line);
+			if (!s.empty() && s[0] == '^') {
+				s.remove_prefix(1); /// peeled tag
+			}
+			if (ParseOid(s, oid)) {
+				tips.push_back(oid);
+			}
+		}
+	}
+
+	/// Maps blob oids back to the first path they show up at, walking the
+	/// trees of every commit reachable from the ref tips. Each commit and tree
+	/// is read once through the store, the walk ends as soon as every target
+	/// has a path
+	class PathWalker {
+	public:
+		explicit PathWalker(ObjectStore &store_) :store(store_) {}
+		void Target(const std::uint8_t *oid) {
+			targets.emplace(OidKey(oid), std::string());
+		}
+		/// number of targets found a path for
+		std::size_t Walk(const std::vector<OidKey> &tips) {
+			std::deque<OidKey> pending(tips.begin(), tips.end());
+			while (!pending.empty() && found < targets.size()) {
+				auto oid = pending.front();
+				pending.pop_front();
+				if (!seen.insert(oid).second) {
+					continue;
+				}
+				auto o = store.Read(oid.b);
+				if (!o) {
+					continue;
+				}
+				if (o->type == pack::Tree) {
+					WalkTree(o);
+					continue;
+				}
+				/// commits: tree and parent lines, tags: object line, up to the first blank line
+				std::string_view text(reinterpret_cast<const char *>(o->data.data()), o->data.size());
+				while (!text.empty() && text[0] != '\n') {
+					auto eol = text.find('\n');
+					auto line = text.substr(0, eol);
+					text.remove_prefix(eol == std::string_view::npos ? text.size() : eol + 1);
+					auto sp = line.find(' ');
+					if (sp == std::string_view::npos) {
+						continue;
+					}
+					auto key = line.substr(0, sp);
+					OidKey next;
+					if ((key == "tree" || key == "parent" || key == "object") && ParseOid(line.substr(sp + 1), next)) {
+						if (key == "tree") {
+							pending.push_front(next); /// trees before the next commit, so early exit comes early
+						}
+						else {
+							pending.push_back(next);
+						}
+					}
+				}
+			}
+			return found;
+		}
+		/// UTF-8 path, nullptr for blobs not reached
+		const std::string *Path(const std::uint8_t *oid) const {
+			auto it = targets.find(OidKey(oid));
+			if (it == targets.end() || it->second.empty()) {
+				return nullptr;
+			}
+			return &it->second;
+		}
+		std::size_t Found() const {
+			return found;
+		}
+	private:
+		/// depth first with an explicit stack, the path buffer grows and
+		/// shrinks with it. Entries are "<mode> <name>\0<20 byte oid>"
+		void WalkTree(ObjectPtr root) {
+			struct Frame {
+				ObjectPtr tree;
+				std::size_t pos;
+				std::size_t prefix;
+			};
+			std::vector<Frame> stack;
+			std::string path;
+			stack.push_back(Frame{ std::move(root), 0, 0 });
+			while (!stack.empty()) {
+				auto &f = stack.back();
+				auto &data = f.tree->data;
+				if (f.pos >= data.size()) {
+					stack.pop_back();
+					continue;
+				}
+				auto p = reinterpret_cast<const char *>(data.data()) + f.pos;
+				auto n = data.size() - f.pos;
+				auto nul = static_cast<const char *>(memchr(p, 0, n));
+				auto sp = static_cast<const char *>(memchr(p, ' ', n));
+				if (nul == nullptr || sp == nullptr || sp > nul || static_cast<std::size_t>(nul - p) + 21 > n) {
+					stack.pop_back(); /// malformed, skip the rest of this tree
+					continue;
+				}
+				std::string_view mode(p, static_cast<std::size_t>(sp - p));
+				std::string_view name(sp + 1, static_cast<std::size_t>(nul - sp - 1));
+				auto oid = reinterpret_cast<const std::uint8_t *>(nul + 1);
+				f.pos += static_cast<std::size_t>(nul - p) + 21;
+				auto prefix = f.prefix;
+				if (mode == "160000") {
+					continue; /// submodule commit, lives in another repository
+				}
+				if (mode == "40000") {
+					if (!seen.insert(OidKey(oid)).second) {
+						continue;
+					}
+					auto sub = store.Read(oid);
+					if (sub && sub->type == pack::Tree) {
+						path.resize(prefix);
+						path.append(name).push_back('/');
+						stack.push_back(Frame{ std::move(sub), 0, path.size() }); /// f is dangling from here
+					}
+					continue;
+				}
+				auto it = targets.find(OidKey(oid));
+				if (it != targets.end() && it->second.empty()) {
+					path.resize(prefix);
+					it->second.assign(path).append(name);
+					if (++found == targets.size()) {
+						return;
+					}
+				}
+			}
+		}
+		ObjectStore &store;
+		std::unordered_map<OidKey, std::string, OidHash> targets;
+		OidSet seen; /// commits, tags and trees already walked
+		std::size_t found{ 0 };
+	};
+}
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef GIT_WAZE_URING_HPP
+#define GIT_WAZE_URING_HPP
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include "base.hpp"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define GIT_WAZE_URING 1
+#endif
+#endif
+#ifndef GIT_WAZE_URING
+#define GIT_WAZE_URING 0
+#endif
+
+#if GIT_WAZE_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+namespace base {
+	/// Reads ahead of a scan through io_uring, set up with raw syscalls so
+	/// there is no liburing to link. The data is thrown away: a buffered read
+	/// leaves the page in the page cache, and the mapped view then finds it
+	/// there instead of faulting one page at a time. Up to Depth reads are
+	/// in flight. Without io_uring (other systems, old kernels, seccomp) Ready
+	/// is false and the scan reads as before
+	class Uring {
+	public:
+		enum : std::uint32_t {
+			Depth = 64,
+			ReadSize = 64 /// an object header and the start of its zlib stream
+		};
+		Uring(const Uring &) = delete;
+		Uring &operator=(const Uring &) = delete;
+		/// one ring per thread, kept across packs
+		static Uring &Local() {
+			static thread_local Uring ring;
+			return ring;
+		}
+		bool Ready() const {
+			return ringfd >= 0;
+		}
+		/// queue a read of ReadSize bytes at offset, false while every slot is
+		/// taken. Goes out with the next Submit
+		bool Read(FileHandle fd, std::uint64_t offset) {
+#if GIT_WAZE_URING
+			if (!Ready()) {
+				return false;
+			}
+			if (nfree == 0) {
+				Reap();
+				if (nfree == 0) {
+					return false;
+				}
+			}
+			auto slot = freeslots[--nfree];
+			auto tail = *sq.tail;
+			auto idx = tail & *sq.mask;
+			auto &e = sqes[idx];
+			memset(&e, 0, sizeof(e));
+			e.opcode = IORING_OP_READ;
+			e.fd = fd;
+			e.off = offset;
+			e.addr = reinterpret_cast<std::uint64_t>(buffers + slot * ReadSize);
+			e.len = ReadSize;
+			e.user_data = slot;
+			sq.array[idx] = idx;
+			__atomic_store_n(sq.tail, tail + 1, __ATOMIC_RELEASE);
+			pending++;
+			return true;
+#else
+			(void)fd;
+			(void)offset;
+			return false;
+#endif
+		}
+		/// hand queued reads to the kernel, never waits for them. On failure
+		/// the rest stay queued for the next Submit
+		void Submit() {
+#if GIT_WAZE_URING
+			while (pending > 0) {
+				auto n = Enter(pending, 0, 0);
+				if (n <= 0) {
+					break;
+				}
+				pending -= static_cast<std::uint32_t>(n);
+			}
+#endif
+		}
+		/// take finished reads off the completion queue, their slots are free again
+		void Reap() {
+#if GIT_WAZE_URING
+			auto head = *cq.head;
+			auto tail = __atomic_load_n(cq.tail, __ATOMIC_ACQUIRE);
+			while (head != tail) {
+				freeslots[nfree++] = static_cast<std::uint32_t>(cq.cqes[head & *cq.mask].user_data);
+				head++;
+			}
+			__atomic_store_n(cq.head, head, __ATOMIC_RELEASE);
+#endif
+		}
+		/// in flight or queued
+		std::uint32_t Busy() const {
+			return Depth - nfree;
+		}
+	private:
+		Uring() {
+#if GIT_WAZE_URING
+			io_uring_params p;
+			memset(&p, 0, sizeof(p));
+			ringfd = static_cast<int>(syscall(__NR_io_uring_setup, Depth, &p));
+			if (ringfd < 0) {
+				return;
+			}
+			sqsize = p.sq_off.array + p.sq_entries * sizeof(std::uint32_t);
+			cqsize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+			if (p.features & IORING_FEAT_SINGLE_MMAP) {
+				sqsize = cqsize = (std::max)(sqsize, cqsize);
+			}
+			sqmap = mmap(nullptr, sqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+			cqmap = (p.features & IORING_FEAT_SINGLE_MMAP) ? sqmap :
+				mmap(nullptr, cqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_CQ_RING);
+			sqemap = mmap(nullptr, p.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				ringfd, IORING_OFF_SQES);
+			if (sqmap == MAP_FAILED || cqmap == MAP_FAILED || sqemap == MAP_FAILED) {
+				Teardown(p.sq_entries);
+				return;
+			}
+			sqentries = p.sq_entries;
+			auto s = static_cast<std::uint8_t *>(sqmap);
+			sq.tail = reinterpret_cast<std::uint32_t *>(s + p.sq_off.tail);
+			sq.mask = reinterpret_cast<std::uint32_t *>(s + p.sq_off.ring_mask);
+			sq.array = reinterpret_cast<std::uint32_t *>(s + p.sq_off.array);
+			auto c = static_cast<std::uint8_t *>(cqmap);
+			cq.head = reinterpret_cast<std::uint32_t *>(c + p.cq_off.head);
+			cq.tail = reinterpret_cast<std::uint32_t *>(c + p.cq_off.tail);
+			cq.mask = reinterpret_cast<std::uint32_t *>(c + p.cq_off.ring_mask);
+			cq.cqes = reinterpret_cast<io_uring_cqe *>(c + p.cq_off.cqes);
+			sqes = static_cast<io_uring_sqe *>(sqemap);
+			for (std::uint32_t i = 0; i < Depth; i++) {
+				freeslots[nfree++] = i;
+			}
+#endif
+		}
+		~Uring() {
+#if GIT_WAZE_URING
+			if (!Ready()) {
+				return;
+			}
+			/// the kernel may still write into buffers, wait for every read it
+			/// was given. Reads a failed Submit left queued never complete
+			Submit();
+			Reap();
+			while (Busy() > pending) {
+				if (Enter(0, 1, IORING_ENTER_GETEVENTS) < 0) {
+					break;
+				}
+				Reap();
+			}
+			Teardown(sqentries);
+#endif
+		}
+#if GIT_WAZE_URING
+		int Enter(std::uint32_t submit, std::uint32_t wait, std::uint32_t flags) {
+			for (;;) {
+				auto n = static_cast<int>(syscall(__NR_io_uring_enter, ringfd, submit, wait, flags, nullptr, 0));
+				if (n < 0 && errno == EINTR) {
+					continue;
+				}
+				return n;
+			}
+		}
+		void Teardown(std::uint32_t entries) {
+			if (sqemap != nullptr && sqemap != MAP_FAILED) {
+				munmap(sqemap, entries * sizeof(io_uring_sqe));
+			}
+			if (cqmap != nullptr && cqmap != MAP_FAILED && cqmap != sqmap) {
+				munmap(cqmap, cqsize);
+			}
+			if (sqmap != nullptr && sqmap != MAP_FAILED) {
+				munmap(sqmap, sqsize);
+			}
+			close(ringfd);
+			ringfd = -1;
+		}
+		struct {
+			std::uint32_t *tail;
+			std::uint32_t *mask;
+			std::uint32_t *array;
+		} sq{};
+		struct {
+			std::uint32_t *head;
+			std::uint32_t *tail;
+			std::uint32_t *mask;
+			io_uring_cqe *cqes;
+		} cq{};
+		io_uring_sqe *sqes{ nullptr };
+		void *sqmap{ nullptr };
+		void *cqmap{ nullptr };
+		void *sqemap{ nullptr };
+		std::size_t sqsize{ 0 };
+		std::size_t cqsize{ 0 };
+		std::uint32_t sqentries{ 0 };
+		std::uint32_t pending{ 0 }; /// queued, not yet submitted
+#endif
+		int ringfd{ -1 };
+		std::uint32_t freeslots[Depth];
+		std::uint32_t nfree{ 0 };
+		std::uint8_t buffers[Depth * ReadSize];
+	};
+}
+
+#endif
@@ -0,0 +1,78 @@
+// base_test.cpp: MapView and BlockReader read back what was written
+//
+#include "stdafx.h"
+#include "base.hpp"
+#include "check.hpp"
+
+namespace {
+	std::vector<std::uint8_t> Pattern(std::size_t n) {
+		std::vector<std::uint8_t> v(n);
+		std::uint32_t x = 2463534242U;
+		for (auto &c : v) {
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			c = static_cast<std::uint8_t>(x);
+		}
+		return v;
+	}
+
+	void MapViewRoundTrip() {
+		auto bytes = Pattern(200000);
+		auto file = check::WriteTemp("mapview.bin", bytes).wstring();
+		base::MapView view;
+		CHECK(view.Open(file));
+		CHECK(view.size() == bytes.size());
+		CHECK(view.data() != nullptr && memcmp(view.data(), bytes.data(), bytes.size()) == 0);
+		CHECK(view.Contains(0, bytes.size()));
+		CHECK(!view.Contains(1, bytes.size()));
+		CHECK(view.At(bytes.size() - 4, 4) == view.data() + bytes.size() - 4);
+		CHECK(view.At(bytes.size() - 4, 5) == nullptr);
+		CHECK(view.At(UINT64_MAX, 1) == nullptr);
+		view.Close();
+		CHECK(view.data() == nullptr && view.size() == 0);
+	}
+
+	void MapViewEmptyAndMissing() {
+		auto file = check::WriteTemp("empty.bin", {}).wstring();
+		base::MapView view;
+		CHECK(view.Open(file));
+		CHECK(view.size() == 0 && view.data() == nullptr);
+		CHECK(!view.Contains(0, 1));
+		std::error_code ec;
+		std::filesystem::remove(file, ec);
+		CHECK(!view.Open(file));
+	}
+
+	/// the buffered fallback serves the same bytes as the mapping, across
+	/// block edges, backwards and short at the end of the file
+	void BlockReaderMatchesMapView() {
+		auto bytes = Pattern(base::BlockReader::BlockSize * 3 + 123);
+		auto file = check::WriteTemp("blockreader.bin", bytes).wstring();
+		base::BlockReader reader;
+		CHECK(reader.Open(file));
+		CHECK(reader.size() == bytes.size());
+		const std::uint64_t offsets[] = { 0, 17, base::BlockReader::BlockSize - 5, base::BlockReader::BlockSize * 2 + 1,
+			100, bytes.size() - 8, bytes.size() - 1 };
+		for (auto off : offsets) {
+			std::size_t avail = 0;
+			auto p = reader.Fetch(off, 32, avail);
+			CHECK(p != nullptr);
+			CHECK(avail == (std::min)(static_cast<std::uint64_t>(32), bytes.size() - off));
+			CHECK(p != nullptr && memcmp(p, bytes.data() + off, avail) == 0);
+		}
+		std::size_t avail = 1;
+		CHECK(reader.Fetch(bytes.size(), 1, avail) == nullptr && avail == 0);
+		/// a span larger than one block grows the buffer
+		auto p = reader.Fetch(1, base::BlockReader::BlockSize * 2, avail);
+		CHECK(p != nullptr && avail == base::BlockReader::BlockSize * 2);
+		CHECK(p != nullptr && memcmp(p, bytes.data() + 1, avail) == 0);
+	}
+}
+
+int main() {
+	MapViewRoundTrip();
+	MapViewEmptyAndMissing();
+	BlockReaderMatchesMapView();
+	return check::Exit();
+}
@@ -0,0 +1,42 @@
+#ifndef GIT_WAZE_TESTS_CHECK_HPP
+#define GIT_WAZE_TESTS_CHECK_HPP
+#pragma once
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/// Just enough for the unit tests: CHECK reports and counts a failure and
+/// carries on, main returns check::Exit()
+namespace check {
+	inline int &Failures() {
+		static int n = 0;
+		return n;
+	}
+	inline void Fail(const char *file, int line, const char *expr) {
+		fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+		Failures()++;
+	}
+	inline int Exit() {
+		if (Failures() != 0) {
+			fprintf(stderr, "%d checks failed\n", Failures());
+			return 1;
+		}
+		return 0;
+	}
+	/// a scratch file of the given bytes under the system temp directory
+	inline std::filesystem::path WriteTemp(const std::string &name, const std::vector<std::uint8_t> &bytes) {
+		auto dir = std::filesystem::temp_directory_path() / "git-waze-tests";
+		std::error_code ec;
+		std::filesystem::create_directories(dir, ec);
+		auto file = dir / name;
+		std::ofstream out(file, std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+		return file;
+	}
+}
+
+#define CHECK(expr) ((expr) ? (void)0 : check::Fail(__FILE__, __LINE__, #expr))
+
+#endif
@@ -0,0 +1,40 @@
+# checkpoint.cmake: a pack that fails its scan is never journaled as complete
+#
+# cmake -DGIT_WAZE=<git-waze> -DFIXTURE=<objects dir parent> -DWORK=<scratch dir> -P checkpoint.cmake
+#
+# fixtures/corrupt holds one pack whose third object is an OFS_DELTA with a
+# base before the start of the pack. The pack engine fails on it at -j 1 and
+# -j 3 alike, so the repository is incomplete: the journal stays, with its
+# header and no record, and a rerun scans the pack again instead of
+# restoring it
+foreach(jobs 1 3)
+  set(journal "${WORK}/checkpoint-j${jobs}.journal")
+  file(REMOVE "${journal}")
+  foreach(pass first rerun)
+    execute_process(
+      COMMAND "${GIT_WAZE}" --engine pack -j ${jobs} --json --checkpoint "${journal}" "${FIXTURE}"
+      RESULT_VARIABLE rc
+      OUTPUT_VARIABLE out
+      ERROR_VARIABLE err
+    )
+    if(rc EQUAL 0)
+      message(FATAL_ERROR "-j ${jobs} ${pass}: exit status 0 for a failed pack\n${out}${err}")
+    endif()
+    string(FIND "${out}" "\"complete\":false" incomplete)
+    if(incomplete EQUAL -1)
+      message(FATAL_ERROR "-j ${jobs} ${pass}: summary is not incomplete\n${out}")
+    endif()
+    string(FIND "${err}" "bad object at offset 142" scanned)
+    if(scanned EQUAL -1)
+      message(FATAL_ERROR "-j ${jobs} ${pass}: the pack was not scanned\n${err}")
+    endif()
+    if(NOT EXISTS "${journal}")
+      message(FATAL_ERROR "-j ${jobs} ${pass}: the journal was removed as if the scan completed")
+    endif()
+    file(SIZE "${journal}" size)
+    if(NOT size EQUAL 32)
+      message(FATAL_ERROR "-j ${jobs} ${pass}: journal of ${size} bytes, only its 32-byte header was expected")
+    endif()
+  endforeach()
+  file(REMOVE "${journal}")
+endforeach()
@@ -0,0 +1,84 @@
+// hexencode_test.cpp: every hex kernel the CPU runs against the scalar one,
+// and Sha1FromIndex against the object names git lists for a real idx
+//
+#include "stdafx.h"
+#include "base.hpp"
+#include "idxfile.hpp"
+#include "check.hpp"
+
+namespace {
+	/// lengths 0 - 199 at every alignment in a 16-byte window, so each kernel
+	/// sees its scalar, full-vector and overlapping-tail paths
+	void KernelsAgree() {
+		std::vector<std::uint8_t> in(256 + 16);
+		for (std::size_t i = 0; i < in.size(); i++) {
+			in[i] = static_cast<std::uint8_t>(i * 151 + 7);
+		}
+		std::vector<char> want(512), got(512);
+		for (auto k : { base::hex::Kernel::Sse2, base::hex::Kernel::Ssse3, base::hex::Kernel::Avx2 }) {
+			if (!base::hex::Runs(k)) {
+				fprintf(stderr, "hex: %s skipped, not supported here\n", base::hex::KernelName(k));
+				continue;
+			}
+			for (std::size_t n = 0; n < 200; n++) {
+				for (std::size_t align = 0; align < 16; align++) {
+					std::fill(want.begin(), want.end(), '#');
+					std::fill(got.begin(), got.end(), '#');
+					base::hex::EncodeScalar(in.data() + align, n, want.data());
+					base::hex::Encode(k, in.data() + align, n, got.data());
+					if (want != got) {
+						fprintf(stderr, "hex: %s differs at length %zu offset %zu\n", base::hex::KernelName(k), n, align);
+						CHECK(want == got);
+						return;
+					}
+				}
+			}
+		}
+		char digits[64];
+		base::HexEncode(in.data(), 32, digits);
+		base::hex::EncodeScalar(in.data(), 32, want.data());
+		CHECK(memcmp(digits, want.data(), 64) == 0);
+	}
+
+	/// fixtures/small.idx is a pack index written by git, small.oids its
+	/// object names in idx order as git show-index prints them
+	void Sha1FromIndexMatchesGit(const std::filesystem::path &fixtures) {
+		base::MapView view;
+		idx::IndexTables t;
+		CHECK(view.Open((fixtures / "small.idx").wstring()) && idx::ParseIndex(view, t));
+		if (t.sha1 == nullptr) {
+			return;
+		}
+		std::ifstream list(fixtures / "small.oids");
+		std::string line;
+		std::uint32_t i = 0;
+		while (std::getline(list, line)) {
+			if (!line.empty() && line.back() == '\r') {
+				line.pop_back();
+			}
+			if (line.empty()) {
+				continue;
+			}
+			CHECK(i < t.norsize);
+			if (i >= t.norsize) {
+				return;
+			}
+			wchar_t buffer[48];
+			auto hex = base::Sha1FromIndex(t.sha1, buffer, i);
+			CHECK(base::ToNarrow(hex) == line);
+			CHECK(base::ToNarrow(base::Sha1FromIndex(t.sha1, i)) == line);
+			i++;
+		}
+		CHECK(i == t.norsize && i != 0);
+	}
+}
+
+int main(int argc, char **argv) {
+	KernelsAgree();
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s fixtures-dir\n", argv[0]);
+		return 1;
+	}
+	Sha1FromIndexMatchesGit(argv[1]);
+	return check::Exit();
+}
@@ -0,0 +1,141 @@
+// idxfile_test.cpp: ParseIndex on idx v2 files written here, large offsets included
+//
+#include "stdafx.h"
+#include "base.hpp"
+#include "idxfile.hpp"
+#include "check.hpp"
+
+namespace {
+	void PutBE32(std::vector<std::uint8_t> &v, std::uint32_t x) {
+		for (int s = 24; s >= 0; s -= 8) {
+			v.push_back(static_cast<std::uint8_t>(x >> s));
+		}
+	}
+
+	/// n sorted oids spread over the first byte, every seventh offset past 2 GB
+	struct Fixture {
+		std::vector<std::uint8_t> oids;
+		std::vector<std::uint64_t> offsets;
+		std::vector<std::uint8_t> Write() const {
+			auto n = static_cast<std::uint32_t>(offsets.size());
+			std::vector<std::uint8_t> v;
+			PutBE32(v, 0xff744f63);
+			PutBE32(v, 2);
+			std::uint32_t fanout[256] = { 0 };
+			for (std::uint32_t i = 0; i < n; i++) {
+				fanout[oids[i * 20]]++;
+			}
+			std::uint32_t total = 0;
+			for (auto c : fanout) {
+				total += c;
+				PutBE32(v, total);
+			}
+			v.insert(v.end(), oids.begin(), oids.end());
+			for (std::uint32_t i = 0; i < n; i++) {
+				PutBE32(v, 0x1000 + i); /// crc32
+			}
+			std::vector<std::uint64_t> large;
+			for (auto off : offsets) {
+				if (off > 0x7fffffff) {
+					PutBE32(v, 0x80000000 | static_cast<std::uint32_t>(large.size()));
+					large.push_back(off);
+				}
+				else {
+					PutBE32(v, static_cast<std::uint32_t>(off));
+				}
+			}
+			for (auto off : large) {
+				PutBE32(v, static_cast<std::uint32_t>(off >> 32));
+				PutBE32(v, static_cast<std::uint32_t>(off));
+			}
+			v.insert(v.end(), 40, 0xab); /// pack and idx checksums
+			return v;
+		}
+	};
+
+	Fixture Make(std::uint32_t n) {
+		Fixture f;
+		for (std::uint32_t i = 0; i < n; i++) {
+			auto lead = static_cast<std::uint32_t>((static_cast<std::uint64_t>(i) << 32) / n);
+			std::uint8_t oid[20];
+			for (int k = 0; k < 4; k++) {
+				oid[k] = static_cast<std::uint8_t>(lead >> (24 - k * 8));
+			}
+			for (int k = 4; k < 20; k++) {
+				oid[k] = static_cast<std::uint8_t>(i * 31 + k);
+			}
+			f.oids.insert(f.oids.end(), oid, oid + 20);
+			f.offsets.push_back(i % 7 == 3 ? (3ULL << 31) + i : 12 + i * 100ULL);
+		}
+		return f;
+	}
+
+	void ParseRoundTrip() {
+		auto f = Make(1000);
+		auto file = check::WriteTemp("round.idx", f.Write()).wstring();
+		base::MapView view;
+		CHECK(view.Open(file));
+		idx::IndexTables t;
+		CHECK(idx::ParseIndex(view, t));
+		CHECK(t.norsize == 1000);
+		CHECK(t.lasize == (1000 + 3) / 7);
+		CHECK(memcmp(t.sha1, f.oids.data(), f.oids.size()) == 0);
+		for (std::uint32_t i = 0; i < t.norsize; i++) {
+			CHECK(t.Offset(i) == f.offsets[i]);
+			CHECK(base::LoadBE32(t.crc32 + i * 4ULL) == 0x1000 + i);
+			CHECK(t.Find(f.oids.data() + i * 20ULL) == i);
+		}
+		std::uint8_t absent[20];
+		memcpy(absent, f.oids.data() + 500 * 20, 20);
+		absent[19] ^= 0x80;
+		CHECK(t.Find(absent) == UINT32_MAX);
+		idx::Lookup lookup;
+		CHECK(lookup.Open(file));
+		std::uint64_t off = 0;
+		CHECK(lookup.Offset(f.oids.data() + 3 * 20, off) && off == f.offsets[3]);
+		CHECK(!lookup.Offset(absent, off));
+	}
+
+	void ParseEmpty() {
+		auto file = check::WriteTemp("empty.idx", Fixture().Write()).wstring();
+		base::MapView view;
+		CHECK(view.Open(file));
+		idx::IndexTables t;
+		CHECK(idx::ParseIndex(view, t));
+		CHECK(t.norsize == 0 && t.lasize == 0);
+	}
+
+	void ParseRejects() {
+		auto bytes = Make(50).Write();
+		auto truncated = bytes;
+		truncated.resize(bytes.size() - 50 * 4 - 41);
+		auto badmagic = bytes;
+		badmagic[0] = 0;
+		auto v1 = bytes;
+		v1[7] = 1;
+		for (const auto &b : { truncated, badmagic, v1 }) {
+			auto file = check::WriteTemp("bad.idx", b).wstring();
+			base::MapView view;
+			CHECK(view.Open(file));
+			idx::IndexTables t;
+			CHECK(!idx::ParseIndex(view, t));
+		}
+		/// a large offset slot past the large offset table
+		auto f = Make(10);
+		auto dangling = f.Write();
+		auto slot = 8 + 256 * 4 + 10 * 24 + 3 * 4;
+		dangling[slot + 3] = 0x7f;
+		auto file = check::WriteTemp("dangling.idx", dangling).wstring();
+		base::MapView view;
+		idx::IndexTables t;
+		CHECK(view.Open(file) && idx::ParseIndex(view, t));
+		CHECK(t.Offset(3) == UINT64_MAX);
+	}
+}
+
+int main() {
+	ParseRoundTrip();
+	ParseEmpty();
+	ParseRejects();
+	return check::Exit();
+}
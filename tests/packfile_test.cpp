@@ -0,0 +1,95 @@
+// packfile_test.cpp: object headers encoded here decode to the same type and size
+//
+#include "stdafx.h"
+#include "base.hpp"
+#include "packfile.hpp"
+#include "check.hpp"
+
+namespace {
+	/// type and size as git writes them: 4 size bits in the first byte, then 7 per byte
+	std::size_t EncodeHeader(std::uint8_t *p, std::uint8_t type, std::uint64_t size) {
+		std::size_t k = 0;
+		auto c = static_cast<std::uint8_t>((type << 4) | (size & 15));
+		size >>= 4;
+		while (size != 0) {
+			p[k++] = c | 0x80;
+			c = static_cast<std::uint8_t>(size & 0x7f);
+			size >>= 7;
+		}
+		p[k++] = c;
+		return k;
+	}
+
+	void RoundTrip() {
+		const std::uint8_t types[] = { pack::Commit, pack::Tree, pack::Blob, pack::Tag, pack::OfsDelta, pack::RefDelta };
+		std::vector<std::uint64_t> sizes = { 0, 1, 15, 16, 127, 128, 2047, 2048, UINT32_MAX, UINT64_MAX };
+		for (int b = 1; b < 64; b++) {
+			sizes.push_back((1ULL << b) - 1);
+			sizes.push_back(1ULL << b);
+		}
+		for (auto type : types) {
+			for (auto size : sizes) {
+				std::uint8_t buf[pack::MaxHeaderSize + 4];
+				memset(buf, 0xff, sizeof(buf));
+				auto n = EncodeHeader(buf, type, size);
+				CHECK(n <= pack::MaxHeaderSize);
+				pack::ObjectHeader h;
+				CHECK(pack::DecodeHeader(buf, buf + n, h));
+				CHECK(h.type == type && h.size == size && h.length == n);
+				/// trailing bytes are not part of the header
+				CHECK(pack::DecodeHeader(buf, buf + sizeof(buf), h) && h.length == n);
+				if (n > 1) {
+					CHECK(!pack::DecodeHeader(buf, buf + n - 1, h));
+				}
+			}
+		}
+	}
+
+	void Rejects() {
+		pack::ObjectHeader h;
+		std::uint8_t one = 0x30;
+		CHECK(!pack::DecodeHeader(&one, &one, h));
+		/// a header that ends after eleven bytes carries more than 64 size bits
+		std::uint8_t overlong[11];
+		memset(overlong, 0xff, sizeof(overlong));
+		overlong[10] = 0x01;
+		CHECK(!pack::DecodeHeader(overlong, overlong + sizeof(overlong), h));
+	}
+
+	/// headers decoded through PackView read the same whether the pack is
+	/// mapped or block buffered
+	void ViewRoundTrip() {
+		std::vector<std::uint8_t> bytes = { 'P', 'A', 'C', 'K', 0, 0, 0, 2, 0, 0, 0, 0 };
+		std::vector<std::pair<std::uint64_t, std::uint64_t>> entries;
+		for (std::uint64_t i = 0; i < 5000; i++) {
+			std::uint8_t buf[pack::MaxHeaderSize];
+			auto size = (i * 2654435761ULL) >> (i % 40);
+			entries.emplace_back(bytes.size(), size);
+			auto n = EncodeHeader(buf, pack::Blob, size);
+			bytes.insert(bytes.end(), buf, buf + n);
+			bytes.insert(bytes.end(), static_cast<std::size_t>(i % 23), 0); /// body
+		}
+		bytes.insert(bytes.end(), 20, 0);
+		auto file = check::WriteTemp("headers.pack", bytes).wstring();
+		pack::PackView view;
+		CHECK(view.Open(file) && view.Mapped());
+		base::BlockReader reader;
+		CHECK(reader.Open(file));
+		for (const auto &e : entries) {
+			std::size_t avail = 0;
+			auto p = view.Fetch(e.first, pack::MaxHeaderSize, avail);
+			pack::ObjectHeader h;
+			CHECK(p != nullptr && pack::DecodeHeader(p, p + avail, h) && h.size == e.second && h.type == pack::Blob);
+			auto q = reader.Fetch(e.first, pack::MaxHeaderSize, avail);
+			pack::ObjectHeader g;
+			CHECK(q != nullptr && pack::DecodeHeader(q, q + avail, g) && g.size == e.second && g.length == h.length);
+		}
+	}
+}
+
+int main() {
+	RoundTrip();
+	Rejects();
+	ViewRoundTrip();
+	return check::Exit();
+}